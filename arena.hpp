@@ -0,0 +1,51 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+// Append-only storage for text that lives as long as the server (routing log
+// bodies). Strings are copied into large blocks and handed back as views, so
+// keeping one is a memcpy; the heap is only touched once per block.
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+static const size_t ARENA_BLOCK = 256 * 1024;
+
+struct TextArena {
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<std::unique_ptr<char[]>> large; // text over a quarter block, one allocation each
+    size_t cur = 0;            // blocks in use; blocks[cur - 1] is being filled, the rest are spare
+    size_t used = ARENA_BLOCK; // bytes taken in that block (full: none yet)
+    size_t bytes = 0;          // text stored
+
+    // Allocate room for n more bytes of short text up front (route_check
+    // measures routing without the arena's occasional block allocation)
+    void reserve(size_t n) {
+        size_t want = cur + n / ARENA_BLOCK + 1;
+        blocks.reserve(want);
+        while (blocks.size() < want) blocks.emplace_back(new char[ARENA_BLOCK]);
+    }
+
+    std::string_view store(std::string_view s) {
+        if (s.empty()) return {};
+        bytes += s.size();
+        char *p;
+        if (s.size() > ARENA_BLOCK / 4) {
+            large.emplace_back(new char[s.size()]);
+            p = large.back().get();
+        } else {
+            if (used + s.size() > ARENA_BLOCK) {
+                if (cur == blocks.size()) blocks.emplace_back(new char[ARENA_BLOCK]);
+                cur++;
+                used = 0;
+            }
+            p = blocks[cur - 1].get() + used;
+            used += s.size();
+        }
+        memcpy(p, s.data(), s.size());
+        return {p, s.size()};
+    }
+};
+
+#endif // ARENA_HPP
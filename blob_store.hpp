@@ -0,0 +1,139 @@
+#ifndef BLOB_STORE_HPP
+#define BLOB_STORE_HPP
+
+// Server-side attachment store, keyed by content (blob id = hash + size).
+//
+// A blob is created empty when someone offers content the store does not have
+// and is filled by PUT chunks in order; only complete blobs can be fetched.
+// The store is bounded: when it grows past BLOB_STORE_MAX the least recently
+// used blobs (offered, uploaded or fetched) are evicted. Uploads in progress
+// are capped at BLOB_MAX_UPLOADING (the stalest is dropped for a new one) and
+// expire after BLOB_UPLOAD_TTL_SEC without a chunk.
+
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "common.hpp"
+
+static const size_t BLOB_STORE_MAX = 256 * 1024 * 1024; // bytes kept in memory
+static const size_t BLOB_MAX_SIZE = 64 * 1024 * 1024;   // largest single attachment
+static const size_t BLOB_MAX_UPLOADING = 64;             // incomplete blobs kept at once
+static const time_t BLOB_UPLOAD_TTL_SEC = 600;           // incomplete blob dropped after this long idle
+
+struct Blob {
+    std::string data;
+    uint64_t size = 0;                    // expected size (from the id)
+    Sha256 hash;                          // running hash of data
+    bool complete = false;
+    time_t touched = 0;                   // last offer or chunk (expires incomplete blobs)
+    std::list<std::string>::iterator lru; // position in BlobStore::lru
+};
+
+struct BlobStore {
+    std::unordered_map<std::string, Blob> blobs;
+    std::list<std::string> lru;           // front = most recently used
+    size_t bytes = 0;                     // sum of data sizes
+    size_t uploading = 0;                 // blobs not complete yet
+
+    // stats
+    uint64_t offers = 0, dedup_hits = 0, bytes_saved = 0;
+    uint64_t bytes_uploaded = 0, bytes_served = 0, chunks_served = 0, evictions = 0, expired = 0;
+};
+
+inline void blob_touch(BlobStore &bs, Blob &b) {
+    bs.lru.splice(bs.lru.begin(), bs.lru, b.lru);
+}
+
+inline Blob *blob_find(BlobStore &bs, const std::string &id) {
+    auto it = bs.blobs.find(id);
+    if (it == bs.blobs.end()) return nullptr;
+    blob_touch(bs, it->second);
+    return &it->second;
+}
+
+inline void blob_erase(BlobStore &bs, const std::string &id) {
+    auto it = bs.blobs.find(id);
+    if (it == bs.blobs.end()) return;
+    bs.bytes -= it->second.data.size();
+    if (!it->second.complete) bs.uploading--;
+    bs.lru.erase(it->second.lru);
+    bs.blobs.erase(it);
+}
+
+// Drop least recently used blobs until the store fits (keep is never dropped)
+inline void blob_evict(BlobStore &bs, const std::string &keep) {
+    auto it = bs.lru.end();
+    while (bs.bytes > BLOB_STORE_MAX && it != bs.lru.begin()) {
+        --it;
+        if (*it == keep) continue;
+        std::string victim = *it;
+        ++it; // erase invalidates the victim's node only
+        blob_erase(bs, victim);
+        bs.evictions++;
+    }
+}
+
+// Drop incomplete blobs idle since before now - BLOB_UPLOAD_TTL_SEC; the
+// caller fails the offers that were waiting for them
+inline void blob_expire(BlobStore &bs, time_t now) {
+    for (auto it = bs.blobs.begin(); it != bs.blobs.end();) {
+        Blob &b = it->second;
+        if (b.complete || now - b.touched < BLOB_UPLOAD_TTL_SEC) { ++it; continue; }
+        bs.bytes -= b.data.size();
+        bs.uploading--;
+        bs.lru.erase(b.lru);
+        it = bs.blobs.erase(it);
+        bs.expired++;
+    }
+}
+
+// Existing blob, or a new empty one for a valid id (nullptr if the id is bad or too large).
+// At BLOB_MAX_UPLOADING the least recently used upload makes room.
+inline Blob *blob_open(BlobStore &bs, const std::string &id) {
+    if (Blob *b = blob_find(bs, id)) {
+        b->touched = time(nullptr);
+        return b;
+    }
+    uint64_t size = blob_id_size(id);
+    if (size == 0 || size > BLOB_MAX_SIZE) return nullptr;
+    if (bs.uploading >= BLOB_MAX_UPLOADING) {
+        for (auto it = bs.lru.end(); it != bs.lru.begin();) {
+            --it;
+            if (bs.blobs[*it].complete) continue;
+            blob_erase(bs, std::string(*it));
+            bs.expired++;
+            break;
+        }
+    }
+    bs.lru.push_front(id);
+    Blob &b = bs.blobs[id];
+    b.size = size;
+    b.touched = time(nullptr);
+    b.lru = bs.lru.begin();
+    bs.uploading++;
+    return &b;
+}
+
+// Append a chunk at offset. Returns false if the offset does not continue the
+// blob (the caller asks the sender to resume from b.data.size()).
+inline bool blob_append(BlobStore &bs, const std::string &id, Blob &b, uint64_t offset, const std::string &chunk) {
+    if (b.complete) return true;
+    if (offset + chunk.size() <= b.data.size()) return true; // already have it (replayed chunk)
+    if (offset != b.data.size() || b.data.size() + chunk.size() > b.size) return false;
+    b.data += chunk;
+    sha256_update(b.hash, chunk.data(), chunk.size());
+    b.touched = time(nullptr);
+    bs.bytes += chunk.size();
+    bs.bytes_uploaded += chunk.size();
+    if (b.data.size() == b.size && blob_id(b.hash, b.size) == id) {
+        b.complete = true;
+        bs.uploading--;
+    }
+    blob_evict(bs, id);
+    return true;
+}
+
+#endif // BLOB_STORE_HPP
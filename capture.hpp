@@ -0,0 +1,132 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+// Binary traffic trace written by "./server --capture FILE" and read by ./replay.
+//
+// File = CAPTURE_MAGIC, then records of a fixed 17-byte little-endian header
+//     ts_us (u64, since capture start) | conn (u32) | kind (u8) | len (u32)
+// followed by len payload bytes. conn numbers TCP connections in accept
+// order (0 for UDP). Frames are stored without the '\n' terminator.
+//
+// Records are appended to a memory buffer and written out in large blocks
+// (capture_flush() at the end of a loop turn), so capturing costs one memcpy
+// per frame on the hot path.
+//
+// The trace holds AUTH frames with passwords, so it is only readable by the
+// owner. A failed write stops the capture (fd = -1, error in Capture::err).
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+static const char CAPTURE_MAGIC[8] = {'C', 'M', 'S', 'C', 'A', 'P', '1', '\n'};
+static const size_t CAPTURE_HEADER = 17;
+static const size_t CAPTURE_FLUSH_BYTES = 256 * 1024; // write when this much is buffered...
+static const int CAPTURE_FLUSH_MS = 1000;             // ...or this long after the last write
+
+enum CaptureKind : uint8_t {
+    CAP_OPEN = 1,   // TCP connection accepted (no payload)
+    CAP_FRAME = 2,  // TCP frame from the client
+    CAP_CLOSE = 3,  // TCP connection closed by either side (no payload)
+    CAP_UDP = 4     // UDP datagram
+};
+
+struct Capture {
+    int fd = -1;
+    std::string buf;
+    std::chrono::steady_clock::time_point start, last_write;
+    uint64_t records = 0, bytes = 0;
+    int err = 0;    // errno of the write that stopped the capture
+};
+
+inline bool capture_open(Capture &c, const std::string &path) {
+    c.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (c.fd < 0) return false;
+    struct stat st;
+    if (fstat(c.fd, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 077) && fchmod(c.fd, 0600) < 0) {
+        close(c.fd); // an existing trace with a wider mode that we cannot tighten
+        c.fd = -1;
+        return false;
+    }
+    c.start = c.last_write = std::chrono::steady_clock::now();
+    c.buf.reserve(CAPTURE_FLUSH_BYTES * 2);
+    c.buf.append(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    return true;
+}
+
+inline void capture_put(std::string &buf, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) buf.push_back((char)(v >> (8 * i)));
+}
+
+inline void capture_record(Capture &c, uint8_t kind, uint32_t conn, const char *data, size_t len) {
+    if (c.fd < 0) return;
+    uint64_t ts = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - c.start).count();
+    capture_put(c.buf, ts, 8);
+    capture_put(c.buf, conn, 4);
+    c.buf.push_back((char)kind);
+    capture_put(c.buf, len, 4);
+    c.buf.append(data, len);
+    c.records++;
+    c.bytes += CAPTURE_HEADER + len;
+}
+
+// False if this write failed; the capture is closed and stays off
+inline bool capture_flush(Capture &c, bool force) {
+    if (c.fd < 0 || c.buf.empty()) return true;
+    auto now = std::chrono::steady_clock::now();
+    if (!force && c.buf.size() < CAPTURE_FLUSH_BYTES &&
+        now - c.last_write < std::chrono::milliseconds(CAPTURE_FLUSH_MS)) return true;
+    size_t off = 0;
+    while (off < c.buf.size()) {
+        ssize_t n = write(c.fd, c.buf.data() + off, c.buf.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            c.err = n < 0 ? errno : EIO;
+            close(c.fd);
+            c.fd = -1;
+            std::string().swap(c.buf);
+            return false;
+        }
+        off += n;
+    }
+    c.buf.clear();
+    c.last_write = now;
+    return true;
+}
+
+// One record read back from a trace
+struct CaptureEntry {
+    uint64_t ts_us;
+    uint32_t conn;
+    uint8_t kind;
+    std::string data;
+};
+
+inline uint64_t capture_get(const char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+// Parse the next record of a trace held in memory at pos; false at the end (or on a torn tail)
+inline bool capture_next(const std::string &trace, size_t &pos, CaptureEntry &e) {
+    if (pos + CAPTURE_HEADER > trace.size()) return false;
+    const char *p = trace.data() + pos;
+    uint32_t len = (uint32_t)capture_get(p + 13, 4);
+    if (pos + CAPTURE_HEADER + len > trace.size()) return false;
+    e.ts_us = capture_get(p, 8);
+    e.conn = (uint32_t)capture_get(p + 8, 4);
+    e.kind = (uint8_t)p[12];
+    e.data.assign(p + CAPTURE_HEADER, len);
+    pos += CAPTURE_HEADER + len;
+    return true;
+}
+
+#endif // CAPTURE_HPP
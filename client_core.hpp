@@ -0,0 +1,812 @@
+#ifndef CLIENT_CORE_HPP
+#define CLIENT_CORE_HPP
+
+// Event-driven department client.
+//
+// ClientCore::run() is a single-threaded epoll loop that owns the TCP
+// connection (connect, AUTH, failover), the UDP socket (heartbeats out,
+// broadcasts in), the heartbeat and reconnect timers (timerfd) and the
+// outbound queue, which is written once per loop turn with pending acks
+// piggybacked. Callbacks run on the loop thread. Other threads hand work to
+// the loop with post() / call(), which wake it through an eventfd.
+//
+// Headless use:
+//     ClientCore core;
+//     core.servers = {{"127.0.0.1", 9090}};
+//     core.on_message = [&](const Message &m) { ... };
+//     core.on_closed = [&](const std::string &why) { core.stop(); };
+//     core.connect("Lahore", "Admissions", "NU-LHR-123");
+//     core.run();
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+// Servers to try in order (primary first, then standbys); UDP port = TCP port + 1
+struct ServerAddr {
+    std::string host;
+    int port;
+};
+
+static const int FAILOVER_ROUNDS = 10;        // passes over the server list before giving up
+static const int FAILOVER_RETRY_MS = 500;     // pause between passes
+static const int CONNECT_TIMEOUT_MS = 3000;   // connect + AUTH reply per server before trying the next
+static const size_t REPLAY_WINDOW_BYTES = 16 * 1024 * 1024; // unconfirmed frames kept for replay after failover
+static const int DOWNLOAD_WINDOW = 4;         // GET requests in flight per download
+
+// Outgoing conversation (one per target department), updated from RCPT frames
+struct Conversation {
+    std::string campus, dept;                 // target as typed by the user
+    uint64_t nextSeq = 1;
+    uint64_t acceptedSeq = 0, deliveredSeq = 0, readSeq = 0;
+    uint64_t lastMsgId = 0;                   // server id of the newest accepted message
+    std::set<uint64_t> rejected;              // seqs the server did not route (RCPT X)
+};
+
+// Acks owed to senders; only the newest per kind and conversation is kept
+// until it rides along with the next outbound frame
+struct PendingAck {
+    std::string kind, campus, dept;
+    uint64_t seq = 0, msgId = 0;
+};
+
+// Sequenced frame kept for replay after a failover, until the server accepts (S) or rejects (X) it
+struct SentFrame {
+    std::string conv;                         // conversation key
+    uint64_t seq;
+    std::string frame;
+};
+
+// Newest message shown from one sender; the server sends frames again until
+// they are acked, so anything not newer than this is a repeat
+struct LastSeen {
+    uint64_t seq = 0, msgId = 0;
+};
+
+// Attachment we offered; kept until the server accepts the OFFER (it may ask for it with NEED)
+struct Upload {
+    std::string data;
+    std::string conv;                         // conversation key
+    uint64_t seq = 0;
+};
+
+// Attachment being fetched into "<download_dir>/<blob id>.part"
+struct Download {
+    struct Waiting {
+        Message m;
+        std::string filename;                 // name this FILEREF gave the content
+    };
+    std::vector<Waiting> msgs;                // FILEREFs waiting for this blob
+    uint64_t size = 0;
+    uint64_t received = 0;                    // bytes in the .part file
+    uint64_t requested = 0;                   // bytes asked for with GET
+    Sha256 hash;                              // running hash of the .part file
+    int fd = -1;
+};
+
+inline std::string lower_str(const std::string &s) {
+    std::string out = s;
+    std::transform(out.begin(), out.end(), out.begin(),
+                   [](unsigned char c){ return std::tolower(c); });
+    return out;
+}
+
+struct ClientCore {
+    std::vector<ServerAddr> servers;
+    std::string session_id;                   // lets the server drop replays of our own messages
+
+    // Callbacks (loop thread)
+    std::function<void()> on_connected;                         // AUTH_OK, first time and after failover
+    std::function<void(const Message&)> on_message;             // FROM, file notices, BCAST, ERR, SHUTDOWN, ...
+    std::function<void(const Message&, const std::string &path)> on_file; // attachment saved, before its on_message
+    std::function<void(const std::string&)> on_notice;          // failover progress, shutdown notice
+    std::function<void(const std::string&)> on_closed;          // gave up: bad credentials, no server, shutdown
+
+    // Loop-thread state; read it from elsewhere through call()
+    std::map<std::string, Conversation> conversations; // lowercase "campus|dept" -> state
+    std::atomic<bool> shutdown_received{false};
+    size_t current_server = 0;
+    std::string download_dir = "received";    // attachments land here, never overwriting a file
+
+    enum State { IDLE, CONNECTING, AUTHENTICATING, READY, CLOSED };
+    State state = IDLE;
+
+    ClientCore() {
+        ep = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        hb_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        retry_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        udp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (ep < 0 || wake_fd < 0 || hb_timer < 0 || retry_timer < 0 || udp < 0) perror("client core");
+        sockaddr_in local{}; local.sin_family = AF_INET; local.sin_addr.s_addr = INADDR_ANY; local.sin_port = 0;
+        if (bind(udp, (sockaddr*)&local, sizeof(local)) < 0) perror("bind udp");
+        watch(wake_fd, EPOLLIN);
+        watch(hb_timer, EPOLLIN);
+        watch(retry_timer, EPOLLIN);
+        watch(udp, EPOLLIN);
+        std::random_device rd;
+        session_id = std::to_string(time(nullptr)) + "-" + std::to_string(rd());
+    }
+
+    ~ClientCore() {
+        for (int fd : {tcp, udp, hb_timer, retry_timer, wake_fd, ep})
+            if (fd >= 0) close(fd);
+    }
+
+    ClientCore(const ClientCore&) = delete;
+    ClientCore &operator=(const ClientCore&) = delete;
+
+    // Start connecting: one pass over servers, first one that accepts us wins
+    void connect(const std::string &campus_, const std::string &dept_, const std::string &pass_) {
+        campus = campus_; dept = dept_; pass = pass_;
+        tried = 0;
+        rounds_left = 1;
+        try_index = 0;
+        start_attempt();
+    }
+
+    // Queue a message / file; returns its sequence number in that conversation
+    uint64_t send_message(const std::string &tcampus, const std::string &tdept, const std::string &body) {
+        return send_sequenced("MSG", tcampus, tdept, body);
+    }
+
+    // Attachments are offered by content id and only uploaded if the server lacks them
+    uint64_t send_file(const std::string &tcampus, const std::string &tdept,
+                       const std::string &filename, const std::string &data) {
+        if (data.empty()) return send_sequenced("FILE", tcampus, tdept, filename + "|");
+        std::string id = blob_id(data);
+        uint64_t seq = send_sequenced("OFFER", tcampus, tdept, filename + "|" + id);
+        uploads[id] = {data, conv_key(tcampus, tdept), seq};
+        return seq;
+    }
+
+    // Read receipt for a received message
+    void ack_read(const Message &m) { queue_ack("R", m.fromCampus, m.fromDept, m.seq, m.id); }
+
+    // Run fn on the loop thread (any thread)
+    void post(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lk(post_mtx);
+            posted.push_back(std::move(fn));
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) { /* counter saturated: loop is awake anyway */ }
+    }
+
+    // Run fn on the loop thread and wait for it
+    void call(std::function<void()> fn) {
+        if (std::this_thread::get_id() == loop_thread) { fn(); return; }
+        std::promise<void> done;
+        post([&] { fn(); done.set_value(); });
+        done.get_future().wait();
+    }
+
+    void stop() { post([this] { running = false; }); }
+
+    void run() {
+        loop_thread = std::this_thread::get_id();
+        running = true;
+        epoll_event evs[16];
+        while (running) {
+            int n = epoll_wait(ep, evs, 16, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                int fd = (int)(uint32_t)evs[i].data.u64;
+                uint32_t gen = evs[i].data.u64 >> 32; // TCP only; events of a closed attempt are stale
+                if (fd == wake_fd) run_posted();
+                else if (fd == hb_timer) { drain(hb_timer); send_heartbeat(); }
+                else if (fd == retry_timer) { if (expired(retry_timer)) on_retry_timer(); }
+                else if (fd == udp) on_udp_readable();
+                else if (fd == tcp && gen == (uint32_t)tcp_gen) on_tcp_event(evs[i].events);
+            }
+            flush();
+        }
+        loop_thread = std::thread::id();
+    }
+
+    // ---- internals (loop thread) ----
+    int ep = -1, wake_fd = -1, hb_timer = -1, retry_timer = -1, udp = -1, tcp = -1;
+    uint64_t tcp_gen = 0;       // bumped for every connection attempt (fd numbers get reused)
+    std::atomic<std::thread::id> loop_thread{};
+    bool running = false;
+    std::mutex post_mtx;
+    std::vector<std::function<void()>> posted;
+
+    std::string campus, dept, pass;
+    size_t try_index = 0;       // server being tried
+    size_t tried = 0;           // servers tried in this pass
+    int rounds_left = 0;        // passes left (FAILOVER_ROUNDS after a drop, 1 at start)
+    bool ever_connected = false;
+    std::chrono::steady_clock::time_point failover_started;
+
+    FrameReader tcp_in;
+    std::string outbuf;         // queued TCP bytes, written at the end of each loop turn
+    bool want_out = false;      // EPOLLOUT armed
+    sockaddr_in server_udp_addr{};
+    std::deque<SentFrame> sent_window;
+    size_t sent_window_bytes = 0;
+    std::map<std::string, PendingAck> pending_acks;
+    std::map<std::string, LastSeen> last_seen;  // sender conversation key -> newest message shown
+    std::map<std::string, Upload> uploads;     // blob id -> offered content
+    std::map<std::string, Download> downloads; // blob id -> transfer in progress
+
+    void watch(int fd, uint32_t events, uint32_t gen = 0) {
+        epoll_event ev{}; ev.events = events; ev.data.u64 = (uint64_t)gen << 32 | (uint32_t)fd;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) < 0) epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    static void drain(int fd) {
+        uint64_t v;
+        while (read(fd, &v, sizeof(v)) > 0) {}
+    }
+
+    // False if the timer was re-armed since this event was queued
+    static bool expired(int timer) {
+        uint64_t v;
+        return read(timer, &v, sizeof(v)) > 0;
+    }
+
+    static void arm(int timer, int first_ms, int interval_ms) {
+        itimerspec its{};
+        its.it_value.tv_sec = first_ms / 1000;
+        its.it_value.tv_nsec = (long)(first_ms % 1000) * 1000000;
+        its.it_interval.tv_sec = interval_ms / 1000;
+        its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+        timerfd_settime(timer, 0, &its, nullptr);
+    }
+
+    void notice(const std::string &s) { if (on_notice) on_notice(s); }
+
+    void run_posted() {
+        drain(wake_fd);
+        std::vector<std::function<void()>> fns;
+        {
+            std::lock_guard<std::mutex> lk(post_mtx);
+            fns.swap(posted);
+        }
+        for (auto &fn : fns) fn();
+    }
+
+    static std::string conv_key(const std::string &c, const std::string &d) {
+        return lower_str(c) + "|" + lower_str(d);
+    }
+
+    void close_tcp() {
+        if (tcp < 0) return;
+        close(tcp); // also leaves the epoll set
+        tcp = -1;
+        want_out = false;
+    }
+
+    void close_core(const std::string &why) {
+        close_tcp();
+        arm(hb_timer, 0, 0);
+        arm(retry_timer, 0, 0);
+        state = CLOSED;
+        if (on_closed) on_closed(why);
+    }
+
+    // ---- connection state machine ----
+    void start_attempt() {
+        const ServerAddr &sa = servers[try_index];
+        tcp_gen++;
+        tcp = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (tcp < 0) { perror("tcp socket"); next_attempt(); return; }
+        sockaddr_in srv{};
+        srv.sin_family = AF_INET;
+        srv.sin_port = htons(sa.port);
+        inet_pton(AF_INET, sa.host.c_str(), &srv.sin_addr);
+        if (::connect(tcp, (sockaddr*)&srv, sizeof(srv)) < 0 && errno != EINPROGRESS) {
+            next_attempt();
+            return;
+        }
+        state = CONNECTING;
+        watch(tcp, EPOLLOUT | EPOLLIN, tcp_gen);
+        arm(retry_timer, CONNECT_TIMEOUT_MS, 0); // a host that drops SYNs never fails the connect
+    }
+
+    // retry_timer: the pause between passes is over, or the current attempt timed out
+    void on_retry_timer() {
+        if (state == IDLE) {
+            start_attempt();
+        } else if (state == CONNECTING || state == AUTHENTICATING) {
+            const ServerAddr &sa = servers[try_index];
+            notice("[INFO] No answer from " + sa.host + ":" + std::to_string(sa.port) + " within " +
+                   std::to_string(CONNECT_TIMEOUT_MS) + " ms.");
+            next_attempt();
+        }
+    }
+
+    // Current attempt failed: next server, a pause after a full pass, or give up
+    void next_attempt() {
+        close_tcp();
+        if (++tried < servers.size()) {
+            try_index = (try_index + 1) % servers.size();
+            start_attempt();
+        } else if (--rounds_left > 0) {
+            tried = 0;
+            try_index = (current_server + 1) % servers.size();
+            state = IDLE;
+            arm(retry_timer, FAILOVER_RETRY_MS, 0);
+        } else {
+            close_core(ever_connected ? "Disconnected from server." : "No response from server");
+        }
+    }
+
+    // Connection dropped without a SHUTDOWN: try the other servers, re-authenticate
+    // with the same session and replay frames not yet accepted (the server drops the ones
+    // it already routed)
+    void begin_failover() {
+        close_tcp();
+        failover_started = std::chrono::steady_clock::now();
+        notice("[FAILOVER] Lost connection to " + servers[current_server].host + ":" +
+               std::to_string(servers[current_server].port) + ", trying other servers...");
+        tried = 0;
+        rounds_left = FAILOVER_ROUNDS;
+        try_index = (current_server + 1) % servers.size();
+        start_attempt();
+    }
+
+    void on_tcp_event(uint32_t events) {
+        if (state == CONNECTING) {
+            int err = 0; socklen_t len = sizeof(err);
+            getsockopt(tcp, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err || (events & (EPOLLERR | EPOLLHUP))) { next_attempt(); return; }
+            std::string auth = frame("AUTH|" + campus + "|" + dept + "|" + pass + "|" + session_id);
+            send(tcp, auth.data(), auth.size(), MSG_NOSIGNAL);
+            tcp_in = FrameReader();
+            state = AUTHENTICATING;
+            watch(tcp, EPOLLIN, tcp_gen);
+            return;
+        }
+        if (events & EPOLLOUT) write_out();
+        if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+        uint64_t gen = tcp_gen;
+        char buf[BUFFER_SIZE];
+        ssize_t r;
+        while ((r = recv(tcp, buf, sizeof(buf), 0)) > 0) tcp_in.feed(buf, r);
+        bool lost = (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) || tcp_in.overflowed();
+
+        // a rejected AUTH moves on to the next server (usually under the same fd
+        // number); stop reading this connection's frames then
+        std::string f;
+        while (tcp_gen == gen && tcp_in.next(f)) {
+            if (state == AUTHENTICATING) on_auth_reply(f);
+            else handle_frame(f);
+        }
+        if (!lost || tcp_gen != gen) return;
+        if (state == AUTHENTICATING) next_attempt();
+        else if (shutdown_received) close_core("Disconnected from server.");
+        else begin_failover();
+    }
+
+    void on_auth_reply(const std::string &reply) {
+        if (reply != "AUTH_OK") {
+            // wrong credentials: no point trying other servers (a standby says "AUTH_FAIL|standby")
+            if (reply == "AUTH_FAIL" && !ever_connected) close_core("Authentication failed: " + reply);
+            else next_attempt();
+            return;
+        }
+        state = READY;
+        arm(retry_timer, 0, 0);
+        current_server = try_index;
+        const ServerAddr &sa = servers[current_server];
+        server_udp_addr = sockaddr_in{};
+        server_udp_addr.sin_family = AF_INET;
+        server_udp_addr.sin_port = htons(sa.port + 1);
+        inet_pton(AF_INET, sa.host.c_str(), &server_udp_addr.sin_addr);
+
+        // first connect: frames queued before AUTH_OK; after a failover: replay
+        outbuf.clear();
+        for (auto &p : sent_window) outbuf += p.frame;
+        if (ever_connected) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - failover_started).count();
+            notice("[FAILOVER] Re-authenticated with " + sa.host + ":" + std::to_string(sa.port) + " in " +
+                   std::to_string(ms) + " ms, replayed " + std::to_string(sent_window.size()) + " unconfirmed frames.");
+        }
+        ever_connected = true;
+        // in-flight GETs died with the old connection
+        for (auto &d : downloads) {
+            d.second.requested = d.second.received;
+            request_chunks(d.first, d.second);
+        }
+        send_heartbeat();
+        arm(hb_timer, HEARTBEAT_INTERVAL * 1000, HEARTBEAT_INTERVAL * 1000);
+        if (on_connected) on_connected();
+    }
+
+    // ---- outbound ----
+    // Record a delivery (D) or read (R) ack for a received message
+    void queue_ack(const std::string &kind, const std::string &fc, const std::string &fd,
+                   uint64_t seq, uint64_t msgId) {
+        if (seq == 0) return;
+        PendingAck &a = pending_acks[kind + "|" + conv_key(fc, fd)];
+        if (seq < a.seq) return;
+        a = {kind, fc, fd, seq, msgId};
+    }
+
+    // All pending acks as one "ACK|Kind|Campus|Dept|Seq|MsgId[|...]" frame
+    std::string take_ack_frame() {
+        if (pending_acks.empty()) return "";
+        std::string f = "ACK";
+        for (auto &p : pending_acks)
+            f += "|" + p.second.kind + "|" + p.second.campus + "|" + p.second.dept + "|" +
+                 std::to_string(p.second.seq) + "|" + std::to_string(p.second.msgId);
+        pending_acks.clear();
+        return frame(f);
+    }
+
+    // Queue "TYPE|<seq>|Campus|Dept|rest" with the next sequence number of that
+    // conversation and keep it for replay; while failing over it only goes out with the replay
+    uint64_t send_sequenced(const std::string &type, const std::string &tc, const std::string &td,
+                            const std::string &rest) {
+        std::string key = conv_key(tc, td);
+        Conversation &c = conversations[key];
+        if (c.campus.empty()) { c.campus = tc; c.dept = td; }
+        uint64_t seq = c.nextSeq++;
+        std::string msg = frame(type + "|" + std::to_string(seq) + "|" + tc + "|" + td + "|" + rest);
+        if (state == READY) outbuf += take_ack_frame() + msg;
+        sent_window_bytes += msg.size();
+        sent_window.push_back({key, seq, std::move(msg)});
+        if (sent_window_bytes > REPLAY_WINDOW_BYTES) {
+            size_t dropped = 0;
+            while (sent_window.size() > 1 && sent_window_bytes > REPLAY_WINDOW_BYTES) {
+                sent_window_bytes -= sent_window.front().frame.size();
+                sent_window.pop_front();
+                dropped++;
+            }
+            notice("[WARN] " + std::to_string(dropped) + " unconfirmed frame(s) dropped from the replay window; "
+                   "they are lost if the server fails before accepting them.");
+        }
+        return seq;
+    }
+
+    // End of a loop turn: acks not yet piggybacked go out on their own, then one write
+    void flush() {
+        if (state != READY) return;
+        outbuf += take_ack_frame();
+        write_out();
+    }
+
+    void write_out() {
+        while (!outbuf.empty()) {
+            ssize_t n = send(tcp, outbuf.data(), outbuf.size(), MSG_NOSIGNAL);
+            if (n <= 0) break; // EAGAIN: wait for EPOLLOUT; errors show up on recv
+            outbuf.erase(0, n);
+        }
+        bool need = !outbuf.empty();
+        if (need != want_out) {
+            want_out = need;
+            watch(tcp, need ? (EPOLLIN | EPOLLOUT) : EPOLLIN, tcp_gen);
+        }
+    }
+
+    void send_heartbeat() {
+        if (state != READY) return;
+        std::string payload = "HB|" + campus + "|" + dept;
+        sendto(udp, payload.data(), payload.size(), 0, (sockaddr*)&server_udp_addr, sizeof(server_udp_addr));
+    }
+
+    // ---- inbound ----
+    // FROM / FILEFROM / FILEREF the server sent again (not acked yet when the
+    // connection dropped). Still acked, so the server stops resending it. A
+    // sender that restarted numbers from 1 again, but its messages get new,
+    // higher server ids.
+    bool is_repeat(const Message &m) {
+        if (m.seq == 0) return false;
+        queue_ack("D", m.fromCampus, m.fromDept, m.seq, m.id);
+        LastSeen &l = last_seen[conv_key(m.fromCampus, m.fromDept)];
+        if (m.seq <= l.seq && m.id <= l.msgId) return true;
+        l.seq = m.seq;
+        l.msgId = std::max(l.msgId, m.id);
+        return false;
+    }
+
+    void deliver(Message &m) {
+        m.toCampus = campus;
+        m.toDept = dept;
+        if (on_message) on_message(m);
+    }
+
+    // RCPT|Kind|Campus|Dept|Seq|MsgId[|...]: cumulative receipts for our conversations,
+    // except X (that one seq was rejected; the server sent the reason as ERR)
+    void apply_receipts(const std::vector<std::string> &toks) {
+        for (size_t i = 1; i + 4 < toks.size(); i += 5) {
+            std::string key = conv_key(toks[i+1], toks[i+2]);
+            Conversation &c = conversations[key];
+            if (c.campus.empty()) { c.campus = toks[i+1]; c.dept = toks[i+2]; }
+            uint64_t seq = strtoull(toks[i+3].c_str(), nullptr, 10);
+            uint64_t msgId = strtoull(toks[i+4].c_str(), nullptr, 10);
+            if (toks[i] == "S") {
+                c.acceptedSeq = std::max(c.acceptedSeq, seq);
+                if (msgId) c.lastMsgId = std::max(c.lastMsgId, msgId);
+            }
+            else if (toks[i] == "D") c.deliveredSeq = std::max(c.deliveredSeq, seq);
+            else if (toks[i] == "R") c.readSeq = std::max(c.readSeq, seq);
+            else if (toks[i] == "X" && c.rejected.insert(seq).second) forget_sent(key, seq);
+        }
+        // accepted frames are not needed for a replay any more
+        for (auto it = sent_window.begin(); it != sent_window.end();) {
+            auto c = conversations.find(it->conv);
+            if (c != conversations.end() && it->seq <= c->second.acceptedSeq) {
+                sent_window_bytes -= it->frame.size();
+                it = sent_window.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (auto it = uploads.begin(); it != uploads.end();) {
+            auto c = conversations.find(it->second.conv);
+            if (c != conversations.end() && it->second.seq <= c->second.acceptedSeq) it = uploads.erase(it);
+            else ++it;
+        }
+    }
+
+    // A rejected frame is not replayed, and its attachment is not uploaded
+    void forget_sent(const std::string &key, uint64_t seq) {
+        for (auto it = sent_window.begin(); it != sent_window.end(); ++it)
+            if (it->seq == seq && it->conv == key) {
+                sent_window_bytes -= it->frame.size();
+                sent_window.erase(it);
+                break;
+            }
+        for (auto it = uploads.begin(); it != uploads.end(); ++it)
+            if (it->second.seq == seq && it->second.conv == key) { uploads.erase(it); break; }
+    }
+
+    // ---- attachments ----
+    // NEED|BlobId|Offset: upload the rest of an offered blob as PUT chunks
+    void send_blob(const std::string &id, uint64_t offset) {
+        auto it = uploads.find(id);
+        if (it == uploads.end()) return;
+        const std::string &data = it->second.data;
+        for (uint64_t off = offset; off < data.size(); off += BLOB_CHUNK)
+            outbuf += frame("PUT|" + id + "|" + std::to_string(off) + "|" +
+                            base64_encode(data.substr(off, BLOB_CHUNK)));
+    }
+
+    void request_chunks(const std::string &id, Download &d) {
+        while (d.requested < d.size && d.requested - d.received < DOWNLOAD_WINDOW * BLOB_CHUNK) {
+            uint64_t len = std::min<uint64_t>(BLOB_CHUNK, d.size - d.requested);
+            outbuf += frame("GET|" + id + "|" + std::to_string(d.requested) + "|" + std::to_string(len));
+            d.requested += len;
+        }
+    }
+
+    // download_dir/name, or "name (n).ext" if that exists already; the name
+    // from the sender is reduced to its last path component
+    std::string unique_path(const std::string &filename) {
+        mkdir(download_dir.c_str(), 0755);
+        std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+        if (name.empty() || name == "." || name == "..") name = "attachment";
+        size_t dot = name.rfind('.');
+        if (dot == 0 || dot == std::string::npos) dot = name.size();
+        std::string path = download_dir + "/" + name;
+        for (int n = 1; access(path.c_str(), F_OK) == 0; ++n)
+            path = download_dir + "/" + name.substr(0, dot) + " (" + std::to_string(n) + ")" + name.substr(dot);
+        return path;
+    }
+
+    // FILEREF|MsgId|Seq|Campus|Dept|Filename|BlobId|Size: fetch the blob,
+    // resuming from a .part file left by an interrupted transfer
+    void start_download(Message &m, const std::string &filename, const std::string &id) {
+        auto it = downloads.find(id);
+        if (it != downloads.end()) { it->second.msgs.push_back({m, filename}); return; }
+        Download &d = downloads[id];
+        d.msgs.push_back({m, filename});
+        d.size = blob_id_size(id);
+        mkdir(download_dir.c_str(), 0755);
+        std::string part = download_dir + "/" + id + ".part";
+        d.fd = open(part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (d.fd < 0) { perror("open .part"); finish_download(id, "[FILE NOT SAVED] "); return; }
+        char buf[BUFFER_SIZE];
+        ssize_t r;
+        while (d.received < d.size && (r = read(d.fd, buf, std::min<uint64_t>(sizeof(buf), d.size - d.received))) > 0) {
+            sha256_update(d.hash, buf, r);
+            d.received += r;
+        }
+        if (ftruncate(d.fd, d.received) < 0) perror("ftruncate");
+        lseek(d.fd, d.received, SEEK_SET);
+        if (d.received) notice("[INFO] Resuming '" + filename + "' at " + std::to_string(d.received) + " bytes.");
+        d.requested = d.received;
+        if (d.received == d.size) finish_download(id, "");
+        else request_chunks(id, d);
+    }
+
+    // DATA|BlobId|Offset|Base64
+    void on_blob_data(const std::string &id, uint64_t offset, const std::string &chunk) {
+        auto it = downloads.find(id);
+        if (it == downloads.end()) return;
+        Download &d = it->second;
+        if (offset != d.received || chunk.empty() || d.received + chunk.size() > d.size) return; // stale
+        if (write(d.fd, chunk.data(), chunk.size()) != (ssize_t)chunk.size()) {
+            perror("write .part");
+            finish_download(id, "[FILE NOT SAVED] ");
+            return;
+        }
+        sha256_update(d.hash, chunk.data(), chunk.size());
+        d.received += chunk.size();
+        if (d.received == d.size) finish_download(id, "");
+        else request_chunks(id, d);
+    }
+
+    // Copy a finished download to a second name (same content offered under another filename)
+    static bool copy_file(const std::string &from, const std::string &to) {
+        int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) return false;
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        bool ok = out >= 0;
+        char buf[BUFFER_SIZE];
+        ssize_t r;
+        while (ok && (r = read(in, buf, sizeof(buf))) > 0) ok = write(out, buf, r) == r;
+        ok = ok && r == 0;
+        close(in);
+        if (out >= 0) close(out);
+        return ok;
+    }
+
+    // Complete (failure empty) or give up with failure as the inbox prefix.
+    // Each filename the waiting messages used is saved once.
+    void finish_download(const std::string &id, std::string failure) {
+        Download d = std::move(downloads[id]);
+        downloads.erase(id);
+        if (d.fd >= 0) close(d.fd);
+        std::string part = download_dir + "/" + id + ".part";
+        if (failure.empty() && blob_id(d.hash, d.size) != id) {
+            failure = "[FILE CORRUPTED] ";
+            unlink(part.c_str());
+        }
+        std::string first;                         // where the .part file went
+        std::map<std::string, std::string> saved;  // filename -> path ("" if it could not be written)
+        for (auto &w : d.msgs) {
+            std::string why = failure;
+            if (why.empty()) {
+                auto s = saved.find(w.filename);
+                if (s == saved.end()) {
+                    std::string path = unique_path(w.filename);
+                    bool ok;
+                    if (first.empty()) {
+                        ok = rename(part.c_str(), path.c_str()) == 0;
+                        if (!ok) perror("rename");
+                        else first = path;
+                    } else {
+                        ok = copy_file(first, path);
+                        if (!ok) unlink(path.c_str());
+                    }
+                    s = saved.emplace(w.filename, ok ? path : "").first;
+                }
+                if (s->second.empty()) why = "[FILE NOT SAVED] ";
+            }
+            Message &m = w.m;
+            m.content = why.empty()
+                ? "[FILE RECEIVED] " + w.filename + " (" + std::to_string(d.size) + " bytes) -> " + saved[w.filename]
+                : why + w.filename;
+            if (why.empty() && on_file) on_file(m, saved[w.filename]);
+            deliver(m);
+        }
+    }
+
+    // Handle one frame received from the server
+    void handle_frame(const std::string &s) {
+        // parse header token
+        std::vector<std::string> toks;
+        std::string tmp;
+        for (char c : s) {
+            if (c=='|') { toks.push_back(tmp); tmp.clear(); } else tmp.push_back(c);
+        }
+        toks.push_back(tmp);
+
+        Message m;
+        if (toks[0] == "FROM" && toks.size() >= 6) {
+            // FROM|MsgId|Seq|Campus|Dept|Body
+            m.id = strtoull(toks[1].c_str(), nullptr, 10);
+            m.seq = strtoull(toks[2].c_str(), nullptr, 10);
+            m.fromCampus = toks[3];
+            m.fromDept = toks[4];
+            m.content = rest_after(s, 5);
+            if (!is_repeat(m)) deliver(m);
+        } else if (toks[0] == "FILEREF" && toks.size() >= 8) {
+            // FILEREF|MsgId|Seq|Campus|Dept|Filename|BlobId|Size
+            m.id = strtoull(toks[1].c_str(), nullptr, 10);
+            m.seq = strtoull(toks[2].c_str(), nullptr, 10);
+            m.fromCampus = toks[3];
+            m.fromDept = toks[4];
+            m.toCampus = campus;
+            m.toDept = dept;
+            if (!is_repeat(m)) start_download(m, toks[5], toks[6]);
+        } else if (toks[0] == "DATA" && toks.size() >= 4) {
+            on_blob_data(toks[1], strtoull(toks[2].c_str(), nullptr, 10), base64_decode(rest_after(s, 3)));
+        } else if (toks[0] == "NEED" && toks.size() >= 3) {
+            send_blob(toks[1], strtoull(toks[2].c_str(), nullptr, 10));
+        } else if (toks[0] == "NOBLOB" && toks.size() >= 2) {
+            // evicted, or lost with a failover; the .part file stays for a later FILEREF
+            if (downloads.count(toks[1])) finish_download(toks[1], "[FILE UNAVAILABLE] ");
+        } else if (toks[0] == "FILEFROM" && toks.size() >= 7) {
+            // FILEFROM|MsgId|Seq|Campus|Dept|Filename|Base64 (attachment sent inline)
+            m.id = strtoull(toks[1].c_str(), nullptr, 10);
+            m.seq = strtoull(toks[2].c_str(), nullptr, 10);
+            m.fromCampus = toks[3];
+            m.fromDept = toks[4];
+            if (is_repeat(m)) return;
+            std::string filename = toks[5];
+            // Remaining part is base64 content (in case | in content)
+            std::string filedata = base64_decode(rest_after(s, 6));
+            std::string path = unique_path(filename);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            bool saved = fd >= 0 && write(fd, filedata.data(), filedata.size()) == (ssize_t)filedata.size();
+            if (fd >= 0) close(fd);
+            m.content = saved ? "[FILE RECEIVED] " + filename + " (" + std::to_string(filedata.size()) + " bytes) -> " + path
+                              : "[FILE NOT SAVED] " + filename;
+            m.toCampus = campus;
+            m.toDept = dept;
+            if (saved && on_file) on_file(m, path);
+            deliver(m);
+        } else if (toks[0] == "RCPT") {
+            apply_receipts(toks);
+        } else if (toks[0] == "BCAST") {
+            m.fromCampus = "ADMIN";
+            m.content = rest_after(s, 1);
+            deliver(m);
+        } else if (toks[0] == "SHUTDOWN") {
+            m.fromCampus = "SERVER";
+            // rejoin the rest
+            size_t p = s.find("|");
+            m.content = (p==std::string::npos ? "Server shutting down" : s.substr(p+1));
+            shutdown_received = true;
+            deliver(m);
+            notice("[NOTICE] Server sent shutdown message. See inbox. Press Enter to close when ready.");
+        } else {
+            // ERR and unknown frames go to the inbox as they are
+            m.fromCampus = "SERVER";
+            m.content = s;
+            deliver(m);
+        }
+    }
+
+    // UDP broadcasts from the admin
+    void on_udp_readable() {
+        char buf[BUFFER_SIZE];
+        ssize_t r;
+        while ((r = recvfrom(udp, buf, sizeof(buf), 0, nullptr, nullptr)) > 0) {
+            std::string s(buf, r);
+            if (s.rfind("BCAST|", 0) != 0) continue;
+            Message m;
+            m.fromCampus = "ADMIN";
+            m.content = s.substr(6);
+            deliver(m);
+        }
+    }
+};
+
+#endif // CLIENT_CORE_HPP
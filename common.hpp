@@ -2,26 +2,179 @@
 #define COMMON_HPP
 
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+#include "sha256.hpp"
 
 // Ports and sizes
 static const int TCP_PORT = 9090;   // server TCP port
 static const int UDP_PORT = 9091;   // server UDP port (heartbeats & broadcasts)
+static const int REPL_PORT = 9092;  // primary -> standby replication link
 static const int BUFFER_SIZE = 8192;
 
+// Every TCP stream carries '\n'-terminated frames (payloads never contain '\n')
+static const char FRAME_END = '\n';
+static const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024; // drop peers that exceed this
+
 // Heartbeat settings
 static const int HEARTBEAT_INTERVAL = 10; // client sends heartbeat every 10s
 static const int MAX_MISSED_HEARTBEATS = 3; // mark offline after missing 3 heartbeats
 
-// Helper: current timestamp string
-inline std::string now_str() {
-    using namespace std::chrono;
-    auto t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+// Helper: timestamp string
+inline std::string time_str(time_t t) {
     char buf[64];
     std::strftime(buf, sizeof(buf), "%F %T", std::localtime(&t));
     return std::string(buf);
 }
 
+inline std::string now_str() {
+    return time_str(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+}
+
+// Collects bytes read from a stream socket and hands back complete frames
+struct FrameReader {
+    std::string buf;
+    size_t head = 0; // start of the first unconsumed byte
+
+    void feed(const char *data, size_t n) {
+        if (head > 0 && head == buf.size()) { buf.clear(); head = 0; }
+        buf.append(data, n);
+    }
+
+    // true when a full frame was extracted into out (without the terminator).
+    // The view points into buf and stays valid until the next feed() or next().
+    bool next(std::string_view &out) {
+        size_t end = buf.find(FRAME_END, head);
+        if (end == std::string::npos) {
+            if (head > 0) { buf.erase(0, head); head = 0; }
+            return false;
+        }
+        out = std::string_view(buf.data() + head, end - head);
+        head = end + 1;
+        return true;
+    }
+
+    bool next(std::string &out) {
+        std::string_view f;
+        if (!next(f)) return false;
+        out.assign(f.data(), f.size());
+        return true;
+    }
+
+    bool overflowed() const { return buf.size() - head > MAX_FRAME_SIZE; }
+};
+
+// Append the frame terminator to a payload
+inline std::string frame(const std::string &payload) {
+    return payload + FRAME_END;
+}
+
+// Everything after the n-th '|' (used for bodies that may themselves contain '|')
+inline std::string_view rest_after(std::string_view s, int n) {
+    size_t pos = 0;
+    for (int seen = 0; seen < n; ++seen) {
+        pos = s.find('|', pos);
+        if (pos == std::string_view::npos) return {};
+        ++pos;
+    }
+    return s.substr(pos);
+}
+
+// Take the next '|'-separated field off the front of s (all of s if there is no '|')
+inline std::string_view next_field(std::string_view &s) {
+    size_t bar = s.find('|');
+    std::string_view f = s.substr(0, bar);
+    s = (bar == std::string_view::npos ? std::string_view() : s.substr(bar + 1));
+    return f;
+}
+
+// Split s on '|' into at most max fields without copying; the last one keeps
+// the rest of s. Returns the number of fields.
+inline size_t split_fields(std::string_view s, std::string_view *out, size_t max) {
+    size_t n = 0;
+    while (n + 1 < max && s.find('|') != std::string_view::npos) out[n++] = next_field(s);
+    out[n++] = s;
+    return n;
+}
+
+// Decimal field (0 if it does not start with a number)
+inline uint64_t to_u64(std::string_view s) {
+    uint64_t v = 0;
+    std::from_chars(s.data(), s.data() + s.size(), v);
+    return v;
+}
+
+// simple base64 encode/decode (for file transfer)
+static const std::string b64_chars =
+             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+             "abcdefghijklmnopqrstuvwxyz"
+             "0123456789+/";
+
+inline std::string base64_encode(const std::string &in) {
+    std::string out;
+    int val=0, valb=-6;
+    for (unsigned char c : in) {
+        val = (val<<8) + c;
+        valb += 8;
+        while (valb>=0) {
+            out.push_back(b64_chars[(val>>valb)&0x3F]);
+            valb -= 6;
+        }
+    }
+    if (valb>-6) out.push_back(b64_chars[((val<<8)>>(valb+8))&0x3F]);
+    while (out.size()%4) out.push_back('=');
+    return out;
+}
+
+inline std::string base64_decode(std::string_view in) {
+    static const std::vector<int> T = [] {
+        std::vector<int> t(256,-1);
+        for (int i=0;i<64;i++) t[(unsigned char)b64_chars[i]] = i;
+        return t;
+    }();
+    std::string out;
+    out.reserve(in.size() / 4 * 3);
+    int val=0, valb=-8;
+    for (unsigned char c : in) {
+        if (T[c] == -1) break;
+        val = (val<<6) + T[c];
+        valb += 6;
+        if (valb>=0) {
+            out.push_back(char((val>>valb)&0xFF));
+            valb -= 8;
+        }
+    }
+    return out;
+}
+
+// Attachments are content-addressed: id = "<SHA-256 hex>-<size>"
+static const size_t BLOB_CHUNK = 48 * 1024; // raw bytes per PUT / DATA frame
+static const size_t BLOB_HASH_HEX = 64;
+
+inline std::string blob_id(const Sha256 &hash, uint64_t size) {
+    return sha256_hex(hash) + "-" + std::to_string(size);
+}
+
+inline std::string blob_id(const std::string &data) {
+    Sha256 h;
+    sha256_update(h, data.data(), data.size());
+    return blob_id(h, data.size());
+}
+
+// Size encoded in a blob id (0 if malformed)
+inline uint64_t blob_id_size(const std::string &id) {
+    size_t dash = id.find('-');
+    if (dash != BLOB_HASH_HEX || id.size() < BLOB_HASH_HEX + 2) return 0;
+    return std::strtoull(id.c_str() + BLOB_HASH_HEX + 1, nullptr, 10);
+}
+
 // Message structure
 struct Message {
     std::string fromCampus;
@@ -29,7 +182,9 @@ struct Message {
     std::string toCampus;
     std::string toDept;
     std::string content;
-    bool read = false; // true if read by client
+    bool read = false; // true if read by client (a read receipt goes back to the sender)
+    uint64_t id = 0;   // server-stamped message id (0 for notices)
+    uint64_t seq = 0;  // sender's sequence number in this conversation
 };
 
 // Campus information for heartbeat monitoring
@@ -0,0 +1,65 @@
+#ifndef FRAME_RING_HPP
+#define FRAME_RING_HPP
+
+// Frames forwarded from one sender to one department, oldest first, kept until
+// the recipient acks them (D) so they can be sent again after a reconnect or a
+// failover. Sequence numbers only grow within a conversation, so an ack pops
+// from the front. Slots keep their string buffers when popped: once the ring
+// has grown to the conversation's working set, pushing a frame is a memcpy.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static const size_t MAX_UNACKED_PER_SENDER = 1000; // oldest frame is dropped beyond this
+
+struct FrameRing {
+    struct Slot {
+        uint64_t seq = 0;
+        std::string frame;
+    };
+    std::vector<Slot> slots;
+    size_t head = 0, count = 0;
+
+    Slot &at(size_t i) { return slots[(head + i) % slots.size()]; }
+
+    // False if older frames were dropped to make room (or belonged to the sender's previous run)
+    bool push(uint64_t seq, std::string_view frame) {
+        bool kept = true;
+        if (count && seq <= at(count - 1).seq) { // sender restarted and numbers from 1 again
+            count = 0;
+            kept = false;
+        }
+        if (count == slots.size()) {
+            if (slots.size() < MAX_UNACKED_PER_SENDER) {
+                std::rotate(slots.begin(), slots.begin() + head, slots.end());
+                head = 0;
+                slots.emplace_back();
+            } else {
+                head = (head + 1) % slots.size();
+                count--;
+                kept = false;
+            }
+        }
+        Slot &s = slots[(head + count) % slots.size()];
+        s.seq = seq;
+        s.frame.assign(frame.data(), frame.size());
+        count++;
+        return kept;
+    }
+
+    // Drop frames up to seq (cumulative ack); returns how many went
+    size_t ack(uint64_t seq) {
+        size_t n = 0;
+        while (count && slots[head].seq <= seq) {
+            head = (head + 1) % slots.size();
+            count--;
+            n++;
+        }
+        return n;
+    }
+};
+
+#endif // FRAME_RING_HPP
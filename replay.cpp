@@ -0,0 +1,390 @@
+// replay.cpp
+// Push a trace recorded with "./server --capture FILE" back into a server and
+// report routing outcomes, throughput and delivery latency, optionally
+// compared against the summary of an earlier run (another build).
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.hpp"
+#include "common.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// One replayed TCP connection
+struct Conn {
+    int fd = -1;
+    FrameReader in;
+    string out;
+    string campus, dept;       // lowercase, from its AUTH frame
+    bool closing = false;      // CAP_CLOSE seen: close once out is written
+    bool authing = false;      // AUTH sent, reply not read yet
+};
+
+string server_host = "127.0.0.1";
+int server_port = TCP_PORT;
+double speed = 1.0;            // 0 = as fast as possible
+int drain_ms = 1000;           // stop after this long without replies once everything is sent
+
+map<uint32_t, Conn> conns;
+int udp_fd = -1;
+sockaddr_in udp_addr{};
+string run_tag;                // appended to session ids so a reused server does not drop our frames
+int auth_pending = 0;          // AUTHs without a reply; later records wait so other connections see the same logins
+
+// Outcomes and measurements
+map<string, uint64_t> sent, received; // frame type -> count
+uint64_t bytes_sent = 0, bytes_received = 0, connect_failures = 0;
+uint64_t rejected = 0;                              // RCPT X groups (messages/files not routed)
+unordered_map<string, Clock::time_point> in_flight; // "from|to|seq" -> send time
+unordered_map<string, int> busy;                    // "campus|dept" -> in_flight entries it sends or receives
+vector<double> latency_us;                          // MSG/FILE/OFFER -> FROM/FILEFROM/FILEREF
+
+string lower(string s) {
+    for (auto &c : s) c = tolower((unsigned char)c);
+    return s;
+}
+
+vector<string> split(const string &s, size_t max_fields) {
+    vector<string> out;
+    size_t pos = 0;
+    while (out.size() + 1 < max_fields) {
+        size_t bar = s.find('|', pos);
+        if (bar == string::npos) break;
+        out.push_back(s.substr(pos, bar - pos));
+        pos = bar + 1;
+    }
+    out.push_back(s.substr(pos));
+    return out;
+}
+
+string frame_type(const string &f) {
+    return f.substr(0, f.find('|'));
+}
+
+void add_in_flight(const string &from, const string &to, const string &seq) {
+    if (!in_flight.emplace(from + "|" + to + "|" + seq, Clock::now()).second) return; // replayed seq
+    busy[from]++;
+    busy[to]++;
+}
+
+void erase_in_flight(unordered_map<string, Clock::time_point>::iterator it, const string &from, const string &to) {
+    in_flight.erase(it);
+    busy[from]--;
+    busy[to]--;
+}
+
+void open_conn(uint32_t id) {
+    Conn &c = conns[id];
+    c = Conn();
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in srv{};
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(server_port);
+    inet_pton(AF_INET, server_host.c_str(), &srv.sin_addr);
+    if (c.fd < 0 || connect(c.fd, (sockaddr*)&srv, sizeof(srv)) < 0) {
+        if (c.fd >= 0) close(c.fd);
+        c.fd = -1;
+        connect_failures++;
+        return;
+    }
+    fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Queue one captured frame on its connection, noting what to expect back
+void send_frame(uint32_t id, string f) {
+    auto it = conns.find(id);
+    if (it == conns.end() || it->second.fd < 0) return;
+    Conn &c = it->second;
+    string type = frame_type(f);
+    if (type == "AUTH") {
+        auto t = split(f, 6);
+        if (t.size() >= 4) {
+            c.campus = lower(t[1]);
+            c.dept = lower(t[2]);
+            if (t.size() >= 5) f = "AUTH|" + t[1] + "|" + t[2] + "|" + t[3] + "|" + t[4] + run_tag;
+        }
+        c.authing = true;
+        auth_pending++;
+    } else if (type == "MSG" || type == "FILE" || type == "OFFER") {
+        auto t = split(f, 5);
+        if (t.size() >= 4) add_in_flight(c.campus + "|" + c.dept, lower(t[2]) + "|" + lower(t[3]), t[1]);
+    }
+    sent[type]++;
+    bytes_sent += f.size() + 1;
+    c.out += f;
+    c.out += FRAME_END;
+}
+
+void on_reply(Conn &c, const string &f) {
+    string type = frame_type(f);
+    received[type]++;
+    bytes_received += f.size() + 1;
+    if (c.authing && (type == "AUTH_OK" || type == "AUTH_FAIL")) {
+        c.authing = false;
+        auth_pending--;
+    }
+    if (type == "FROM" || type == "FILEFROM" || type == "FILEREF") {
+        // <TYPE>|MsgId|Seq|Campus|Dept|...
+        auto t = split(f, 6);
+        if (t.size() < 5) return;
+        string from = lower(t[3]) + "|" + lower(t[4]), to = c.campus + "|" + c.dept;
+        auto it = in_flight.find(from + "|" + to + "|" + t[2]);
+        if (it == in_flight.end()) return;
+        latency_us.push_back(chrono::duration<double, micro>(Clock::now() - it->second).count());
+        erase_in_flight(it, from, to);
+    } else if (type == "RCPT") {
+        auto t = split(f, 1 << 20);
+        for (size_t i = 1; i + 4 < t.size(); i += 5) {
+            if (t[i] != "X") continue;
+            rejected++;
+            string from = c.campus + "|" + c.dept, to = lower(t[i+1]) + "|" + lower(t[i+2]);
+            auto it = in_flight.find(from + "|" + to + "|" + t[i+3]);
+            if (it != in_flight.end()) erase_in_flight(it, from, to);
+        }
+    }
+}
+
+// A recorded close can happen now: with the recorded timing always, faster
+// than that only once nothing it sent or is owed is still on the way
+// (otherwise the outcome depends on how fast the server answered)
+bool can_close(Conn &c) {
+    if (!c.out.empty()) return false;
+    if (speed == 1) return true;
+    return !c.authing && busy[c.campus + "|" + c.dept] == 0;
+}
+
+void close_conn(Conn &c) {
+    if (c.authing) { c.authing = false; auth_pending--; }
+    if (c.fd >= 0) close(c.fd);
+    c.fd = -1;
+}
+
+// One poll() over all connections: write queued frames, read replies.
+// Returns true if any reply arrived.
+bool pump(int timeout_ms) {
+    vector<pollfd> pfds;
+    vector<Conn*> owners;
+    for (auto &p : conns) {
+        Conn &c = p.second;
+        if (c.fd < 0) continue;
+        pfds.push_back({c.fd, (short)(c.out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        owners.push_back(&c);
+    }
+    if (poll(pfds.data(), pfds.size(), timeout_ms) <= 0) return false;
+
+    bool got = false;
+    char buf[BUFFER_SIZE * 8];
+    for (size_t i = 0; i < pfds.size(); ++i) {
+        Conn &c = *owners[i];
+        if (pfds[i].revents & POLLOUT) {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+            if (n > 0) c.out.erase(0, n);
+        }
+        if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t r = recv(c.fd, buf, sizeof(buf), 0);
+            if (r <= 0) {
+                if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) close_conn(c);
+                continue;
+            }
+            c.in.feed(buf, r);
+            string f;
+            while (c.in.next(f)) { on_reply(c, f); got = true; }
+        }
+        if (c.closing && c.fd >= 0 && can_close(c)) close_conn(c);
+    }
+    return got;
+}
+
+double percentile(vector<double> v, double p) {
+    if (v.empty()) return 0;
+    sort(v.begin(), v.end());
+    size_t i = (size_t)min<double>(v.size() - 1, floor(p * (v.size() - 1) + 0.5));
+    return v[i];
+}
+
+// Replies whose counts must match between builds (the rest depend on timing)
+bool is_outcome(const string &key) {
+    static const vector<string> keys = {"routed", "rejected", "sent.", "recv.AUTH_OK", "recv.AUTH_FAIL", "recv.FROM",
+                                        "recv.FILEFROM", "recv.FILEREF", "recv.ERR", "recv.NOBLOB"};
+    for (auto &k : keys)
+        if (key.compare(0, k.size(), k) == 0) return true;
+    return false;
+}
+
+void usage() {
+    cerr << "Usage: ./replay TRACE [--server HOST:PORT] [--speed N|max] [--drain-ms MS]\n"
+         << "                [--save SUMMARY] [--baseline SUMMARY]\n"
+         << "  --speed 1 replays with the recorded timing, 10 ten times faster, max without waiting\n"
+         << "  --save writes this run's numbers; --baseline compares against a saved run and\n"
+         << "  exits with status 2 if routing outcomes differ\n";
+}
+
+int main(int argc, char *argv[]) {
+    string trace_path, save_path, baseline_path;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--server" && i + 1 < argc) {
+            string hp = argv[++i];
+            size_t c = hp.rfind(':');
+            if (c == string::npos) server_port = atoi(hp.c_str());
+            else { server_host = hp.substr(0, c); server_port = atoi(hp.c_str() + c + 1); }
+        } else if (a == "--speed" && i + 1 < argc) {
+            string v = argv[++i];
+            speed = (v == "max" ? 0 : atof(v.c_str()));
+        } else if (a == "--drain-ms" && i + 1 < argc) {
+            drain_ms = atoi(argv[++i]);
+        } else if (a == "--save" && i + 1 < argc) {
+            save_path = argv[++i];
+        } else if (a == "--baseline" && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (trace_path.empty() && a[0] != '-') {
+            trace_path = a;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (trace_path.empty() || speed < 0) { usage(); return 1; }
+
+    // --- Load the trace ---
+    ifstream ifs(trace_path, ios::binary);
+    if (!ifs) { perror("trace"); return 1; }
+    string trace((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+    if (trace.size() < sizeof(CAPTURE_MAGIC) || memcmp(trace.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+        cerr << "Not a capture trace: " << trace_path << "\n";
+        return 1;
+    }
+    vector<CaptureEntry> records;
+    size_t pos = sizeof(CAPTURE_MAGIC);
+    CaptureEntry e;
+    while (capture_next(trace, pos, e)) records.push_back(e);
+    trace.clear();
+    cout << "Loaded " << records.size() << " records from " << trace_path << "\n";
+
+    udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_port = htons(server_port + 1);
+    inet_pton(AF_INET, server_host.c_str(), &udp_addr.sin_addr);
+    run_tag = "-replay" + to_string(getpid()) + "-" + to_string(time(nullptr));
+
+    // --- Replay: due records go out, replies are read in between ---
+    auto start = Clock::now();
+    size_t next = 0;
+    while (next < records.size()) {
+        auto now = Clock::now();
+        int budget = 256; // at max speed, read replies every so often
+        while (next < records.size() && budget-- > 0 && auth_pending == 0) {
+            const CaptureEntry &r = records[next];
+            if (speed > 0) {
+                auto due = start + chrono::microseconds((uint64_t)(r.ts_us / speed));
+                if (due > now) break;
+            }
+            switch (r.kind) {
+            case CAP_OPEN:  open_conn(r.conn); break;
+            case CAP_FRAME: send_frame(r.conn, r.data); break;
+            case CAP_CLOSE: if (conns.count(r.conn)) conns[r.conn].closing = true; break;
+            case CAP_UDP:
+                sendto(udp_fd, r.data.data(), r.data.size(), 0, (sockaddr*)&udp_addr, sizeof(udp_addr));
+                sent["UDP"]++;
+                bytes_sent += r.data.size();
+                break;
+            }
+            next++;
+        }
+        int wait = 0;
+        if (speed > 0 && next < records.size() && auth_pending == 0) {
+            auto due = start + chrono::microseconds((uint64_t)(records[next].ts_us / speed));
+            wait = (int)max<long>(0, chrono::duration_cast<chrono::milliseconds>(due - Clock::now()).count());
+        }
+        pump(min(wait, 50));
+    }
+    auto sent_done = Clock::now();
+
+    // --- Drain: everything written, wait until the server goes quiet ---
+    auto last_reply = Clock::now();
+    while (Clock::now() - last_reply < chrono::milliseconds(drain_ms)) {
+        if (pump(10)) last_reply = Clock::now();
+    }
+    for (auto &p : conns) close_conn(p.second);
+    double send_secs = chrono::duration<double>(sent_done - start).count();
+    double total_secs = chrono::duration<double>(last_reply - start).count();
+
+    // --- Report ---
+    uint64_t frames_sent = 0, routed_expected = 0;
+    for (auto &p : sent) frames_sent += p.second;
+    for (const char *t : {"MSG", "FILE", "OFFER"}) routed_expected += sent[t];
+
+    map<string, double> summary;
+    for (auto &p : sent) summary["sent." + p.first] = p.second;
+    for (auto &p : received) summary["recv." + p.first] = p.second;
+    summary["routed"] = latency_us.size();
+    summary["rejected"] = rejected;
+    summary["connect_failures"] = connect_failures;
+    summary["seconds"] = total_secs;
+    summary["frames_per_sec"] = total_secs > 0 ? frames_sent / total_secs : 0;
+    summary["mb_per_sec"] = total_secs > 0 ? (bytes_sent + bytes_received) / total_secs / 1e6 : 0;
+    summary["latency_p50_us"] = percentile(latency_us, 0.50);
+    summary["latency_p95_us"] = percentile(latency_us, 0.95);
+    summary["latency_p99_us"] = percentile(latency_us, 0.99);
+    summary["latency_max_us"] = percentile(latency_us, 1.0);
+
+    cout << "---- Replay (" << (speed > 0 ? to_string(speed) + "x" : string("max speed")) << " against "
+         << server_host << ":" << server_port << ") ----\n";
+    cout << "Sent " << frames_sent << " frames (" << bytes_sent << " bytes) over " << conns.size()
+         << " connections in " << send_secs << " s, done after " << total_secs << " s\n";
+    cout << "Throughput: " << (long)summary["frames_per_sec"] << " frames/s, " << summary["mb_per_sec"] << " MB/s\n";
+    cout << "Routed: " << latency_us.size() << " of " << routed_expected << " messages/files reached their target, "
+         << rejected << " rejected";
+    if (connect_failures) cout << " (" << connect_failures << " connections refused)";
+    cout << "\n";
+    cout << "Latency (us): p50 " << (long)summary["latency_p50_us"] << ", p95 " << (long)summary["latency_p95_us"]
+         << ", p99 " << (long)summary["latency_p99_us"] << ", max " << (long)summary["latency_max_us"] << "\n";
+    cout << "Replies:";
+    for (auto &p : received) cout << " " << p.first << "=" << p.second;
+    cout << "\n";
+
+    if (!save_path.empty()) {
+        ofstream ofs(save_path);
+        for (auto &p : summary) ofs << p.first << " " << p.second << "\n";
+        cout << "Summary saved to " << save_path << "\n";
+    }
+
+    if (baseline_path.empty()) return 0;
+    ifstream bfs(baseline_path);
+    if (!bfs) { perror("baseline"); return 1; }
+    map<string, double> base;
+    string key; double val;
+    while (bfs >> key >> val) base[key] = val;
+    for (auto &p : summary) base.emplace(p.first, 0);
+    for (auto &p : base) summary.emplace(p.first, 0);
+
+    bool outcome_changed = false;
+    cout << "---- Compared with " << baseline_path << " ----\n";
+    for (auto &p : summary) {
+        double b = base[p.first], v = p.second;
+        bool outcome = is_outcome(p.first);
+        if (outcome && b == v) continue; // only differences and measurements are listed
+        cout << "  " << p.first << ": " << b << " -> " << v;
+        if (outcome) { cout << "  ROUTING OUTCOME CHANGED"; outcome_changed = true; }
+        else if (b != 0) cout << "  (" << (v >= b ? "+" : "") << (long)round((v - b) * 100 / b) << "%)";
+        cout << "\n";
+    }
+    if (!outcome_changed) cout << "Routing outcomes identical.\n";
+    return outcome_changed ? 2 : 0;
+}
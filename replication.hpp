@@ -0,0 +1,187 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+// Primary -> standby replication link.
+//
+// The primary streams state changes as framed records "R|<rseq>|<TYPE>|..."
+// and the standby answers with cumulative "REPL_ACK|<rseq>" frames. Records
+// produced during one poll-loop turn go out in a single send() (one batch),
+// and the primary never waits for an ack before sending the next batch.
+//
+// A new link starts with a snapshot of the primary's state, closed by a
+// SNAPEND record; the standby acks nothing before it.
+//
+// A dropped link alone does not make the standby take over: the primary may
+// have cut a standby that fell behind. The standby sends PING to the primary's
+// client port (sent as a PORT record) and, while PONG comes back, keeps
+// refusing logins and reconnects for a fresh snapshot every REPL_RETRY_MS.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+
+#include "common.hpp"
+
+static const size_t REPL_MAX_BACKLOG = 64 * 1024 * 1024; // drop a standby that falls this far behind
+static const int REPL_CONNECT_TIMEOUT_MS = 1000;        // standby: connect / probe the primary
+static const int REPL_RETRY_MS = 1000;                  // standby: pause between reconnects while the primary is up
+
+struct ReplBatch {
+    uint64_t lastSeq;                           // last record in the batch
+    std::chrono::steady_clock::time_point sentAt;
+};
+
+struct ReplPrimary {
+    int listen_fd = -1;
+    int standby_fd = -1;
+    FrameReader in;             // acks coming back from the standby
+    std::string outbuf;         // records not yet accepted by the kernel
+    uint64_t next_seq = 1;
+    uint64_t flushed_seq = 0;   // last record already handed to send()
+    uint64_t acked_seq = 0;
+    std::deque<ReplBatch> inflight;
+    size_t snapshot_left = 0;   // snapshot bytes not yet sent (allowed on top of REPL_MAX_BACKLOG)
+
+    // stats (replication lag = time from batch send to its ack)
+    uint64_t batches = 0;
+    uint64_t records = 0;
+    double last_lag_us = 0, max_lag_us = 0, sum_lag_us = 0;
+    uint64_t lag_samples = 0;
+};
+
+struct ReplStandby {
+    int fd = -1;                // link to the primary
+    FrameReader in;
+    uint64_t applied_seq = 0;
+    bool snapshot_done = false; // SNAPEND seen on this link
+    bool link_up = false;       // following a primary (logins refused); false once taken over
+    int primary_port = 0;       // primary's client port, from its PORT record
+    std::chrono::steady_clock::time_point retry_at; // next reconnect while fd < 0 and link_up
+    std::chrono::steady_clock::time_point takeover_at;
+    bool first_auth_logged = false;
+};
+
+// Queue one record; returns its replication sequence number
+inline uint64_t repl_append(ReplPrimary &rp, std::string_view record) {
+    uint64_t seq = rp.next_seq++;
+    if (rp.standby_fd < 0) return seq; // nobody to replicate to
+    rp.outbuf += "R|";
+    rp.outbuf += std::to_string(seq);
+    rp.outbuf += '|';
+    rp.outbuf += record;
+    rp.outbuf += FRAME_END;
+    rp.records++;
+    return seq;
+}
+
+// Push queued records to the standby; returns false if the link broke
+inline bool repl_flush(ReplPrimary &rp) {
+    if (rp.standby_fd < 0) return true;
+    if (rp.next_seq - 1 > rp.flushed_seq) {
+        rp.flushed_seq = rp.next_seq - 1;
+        rp.inflight.push_back({rp.flushed_seq, std::chrono::steady_clock::now()});
+        rp.batches++;
+    }
+    while (!rp.outbuf.empty()) {
+        ssize_t n = send(rp.standby_fd, rp.outbuf.data(), rp.outbuf.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        rp.outbuf.erase(0, n);
+        rp.snapshot_left -= std::min(rp.snapshot_left, (size_t)n);
+    }
+    return rp.outbuf.size() <= REPL_MAX_BACKLOG + rp.snapshot_left;
+}
+
+// Cumulative ack from the standby: retire batches and sample the lag
+inline void repl_on_ack(ReplPrimary &rp, uint64_t seq) {
+    if (seq <= rp.acked_seq) return;
+    rp.acked_seq = seq;
+    auto now = std::chrono::steady_clock::now();
+    while (!rp.inflight.empty() && rp.inflight.front().lastSeq <= seq) {
+        double us = std::chrono::duration<double, std::micro>(now - rp.inflight.front().sentAt).count();
+        rp.last_lag_us = us;
+        if (us > rp.max_lag_us) rp.max_lag_us = us;
+        rp.sum_lag_us += us;
+        rp.lag_samples++;
+        rp.inflight.pop_front();
+    }
+}
+
+inline void repl_reset_link(ReplPrimary &rp) {
+    if (rp.standby_fd >= 0) close(rp.standby_fd);
+    rp.standby_fd = -1;
+    rp.in = FrameReader();
+    rp.outbuf.clear();
+    rp.inflight.clear();
+    rp.snapshot_left = 0;
+    rp.flushed_seq = rp.next_seq - 1;
+}
+
+// Standby side: connect to one of the primary's ports within REPL_CONNECT_TIMEOUT_MS;
+// the socket comes back non-blocking
+inline int repl_connect(const std::string &host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) { close(fd); return -1; }
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        pollfd p{fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (errno != EINPROGRESS || poll(&p, 1, REPL_CONNECT_TIMEOUT_MS) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// Standby side: is the primary still serving clients? A connect alone is not
+// enough (the kernel accepts for a process that is exiting or stopped): the
+// server loop itself must answer PING within REPL_CONNECT_TIMEOUT_MS.
+inline bool repl_primary_alive(const std::string &host, int client_port) {
+    if (client_port <= 0) return false;
+    int fd = repl_connect(host, client_port);
+    if (fd < 0) return false;
+    std::string ping = std::string("PING") + FRAME_END;
+    send(fd, ping.data(), ping.size(), MSG_NOSIGNAL);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REPL_CONNECT_TIMEOUT_MS);
+    std::string got;
+    char buf[256];
+    bool alive = false;
+    while (!alive) {
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        pollfd p{fd, POLLIN, 0};
+        if (left <= 0 || poll(&p, 1, left) <= 0) break;
+        ssize_t r = recv(fd, buf, sizeof(buf), 0);
+        if (r <= 0) break;
+        got.append(buf, r);
+        alive = got.find(std::string("PONG") + FRAME_END) != std::string::npos;
+    }
+    close(fd);
+    return alive;
+}
+
+inline void repl_send_ack(ReplStandby &rs) {
+    std::string ack = "REPL_ACK|" + std::to_string(rs.applied_seq) + FRAME_END;
+    send(rs.fd, ack.data(), ack.size(), MSG_NOSIGNAL);
+}
+
+#endif // REPLICATION_HPP
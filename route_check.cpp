@@ -0,0 +1,119 @@
+// route_check.cpp
+// Route messages between two in-process clients through the server's own
+// handlers (on_client_data, end_of_turn), over socketpairs, with no network
+// or event loop in between.
+//   make alloc-check   fails if routing a message allocates (COUNT_ALLOCS build)
+//   make bench         reports ns per routed message
+#define main server_main
+#include "server.cpp"
+#undef main
+
+// Messages routed before measuring, so buffers and rings have grown. Seqs and
+// ids then stay six digits long while measuring: a frame one digit longer than
+// any before it grows its buffer once, which is not steady state.
+static const int WARMUP = 100000;
+static const int MESSAGES = 800000;
+static const int BATCH = 64;       // frames per loop turn; the recipient acks each batch
+
+// Server end of a new client, authenticated; *peer is the client's end
+int connect_client(const char *auth, int *peer) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) { perror("socketpair"); exit(1); }
+    set_nonblocking(sv[1]);
+    on_client_accepted(sv[0]);
+    string f = string(auth) + FRAME_END;
+    on_client_data(sv[0], f.data(), f.size());
+    *peer = sv[1];
+    return sv[0];
+}
+
+// Read whatever the server wrote to a client (recipients would parse it)
+void drain(int fd) {
+    static char buf[1 << 16];
+    while (recv(fd, buf, sizeof(buf), 0) > 0) {}
+}
+
+// Route n messages from a to b in batches; b acks (D) every batch
+void route(int a, int a_peer, int b, int b_peer, int n, uint64_t &seq) {
+    char frame[160];
+    for (int done = 0; done < n; done += BATCH) {
+        for (int i = 0; i < BATCH && done + i < n; ++i) {
+            ++seq;
+            int len = snprintf(frame, sizeof(frame), "MSG|%llu|Karachi|EE|message body number %llu with some padding text\n",
+                               (unsigned long long)seq, (unsigned long long)seq);
+            on_client_data(a, frame, len);
+        }
+        end_of_turn();
+        drain(b_peer);
+        int len = snprintf(frame, sizeof(frame), "ACK|D|Lahore|CS|%llu|%llu\n",
+                           (unsigned long long)seq, (unsigned long long)(next_msg_id - 1));
+        on_client_data(b, frame, len);
+        end_of_turn();
+        drain(a_peer);
+    }
+}
+
+void check_usage() {
+    cerr << "Usage: ./route_check alloc|bench\n"
+         << "  alloc  exit 1 if routing a message allocates (needs -DCOUNT_ALLOCS)\n"
+         << "  bench  ns per routed message\n";
+}
+
+int main(int argc, char *argv[]) {
+    string mode = (argc == 2 ? argv[1] : "");
+    if (mode != "alloc" && mode != "bench") { check_usage(); return 1; }
+#ifndef COUNT_ALLOCS
+    if (mode == "alloc") { cerr << "route_check: alloc needs a -DCOUNT_ALLOCS build (make alloc-check)\n"; return 1; }
+#endif
+
+    streambuf *out = cout.rdbuf(nullptr); // the server's per-message log lines
+    lock_guard<mutex> lock(global_mutex);
+    intern_campuses();
+    int a_peer, b_peer;
+    int a = connect_client("AUTH|Lahore|CS|NU-LHR-123|check", &a_peer);
+    int b = connect_client("AUTH|Karachi|EE|NU-KHI-123|check", &b_peer);
+    end_of_turn();
+    drain(a_peer);
+    drain(b_peer);
+
+    uint64_t seq = 0;
+    route(a, a_peer, b, b_peer, WARMUP, seq);
+    // the routing log keeps every message: make room for the measured ones now
+    routing_log.reserve(routing_log.size() + MESSAGES);
+    log_arena.reserve((size_t)MESSAGES * 64);
+
+    uint64_t first_id = next_msg_id;
+#ifdef COUNT_ALLOCS
+    uint64_t before = heap_allocs;
+    count_allocs = true;
+#endif
+    auto start = chrono::steady_clock::now();
+    route(a, a_peer, b, b_peer, MESSAGES, seq);
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+#ifdef COUNT_ALLOCS
+    count_allocs = false;
+    uint64_t allocs = heap_allocs - before;
+#endif
+    cout.rdbuf(out);
+
+    uint64_t routed = next_msg_id - first_id;
+    if (routed != (uint64_t)MESSAGES) {
+        cout << "route_check: routed " << routed << " of " << MESSAGES << " messages\n";
+        return 1;
+    }
+    if (mode == "bench") {
+        cout << "Routed " << routed << " messages: " << (double)ns / routed << " ns/message ("
+             << (long)(routed * 1e9 / ns) << " msg/s)\n";
+        return 0;
+    }
+#ifdef COUNT_ALLOCS
+    cout << "Routed " << routed << " messages: " << allocs << " heap allocations ("
+         << (double)allocs / routed << " per message)\n";
+    if (allocs > 0) {
+        cout << "FAIL: routing a message should not allocate\n";
+        return 1;
+    }
+    cout << "OK\n";
+#endif
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstring>
 #include <iostream>
@@ -15,12 +16,41 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "common.hpp"
+#include "arena.hpp"
+#include "blob_store.hpp"
+#include "capture.hpp"
+#include "frame_ring.hpp"
+#include "replication.hpp"
+#include "symbols.hpp"
+#ifdef USE_IO_URING
+#include "uring_reactor.hpp"
+#endif
 
 using namespace std;
 
+#ifdef COUNT_ALLOCS
+// make COUNT_ALLOCS=1: count heap allocations made by the event loop thread;
+// admin LIST shows them per routed message
+atomic<uint64_t> heap_allocs{0};
+thread_local bool count_allocs = false;
+void *operator new(size_t n) {
+    if (count_allocs) heap_allocs.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+// GCC pairs the inlined free() with new-expressions elsewhere and warns
+// (-Wmismatched-new-delete); this new does come from malloc
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
+#endif
+
 // Hard-coded credentials: campus -> password (display case preserved)
 map<string, string> credentials = {
     {"Lahore", "NU-LHR-123"},
@@ -31,18 +61,25 @@ map<string, string> credentials = {
     {"Islamabad", "NU-ISB-123"}
 };
 
-// Map lowercase campus -> proper display name
-map<string, string> campus_display_name;
+// Interned names: campus ids come from the credentials, department ids are added at AUTH
+SymbolTable campuses;
+SymbolTable depts;
+vector<string> campus_password; // campus id -> password
 
-// Data per connected client (each client represents a single department)
+// Data per connected client (each client represents a single department).
+// Plain data only; the stream buffers live in the parallel client_io array.
 struct ClientInfo {
     int sockfd;
-    string campusLower;     // lowercase campus
-    string campusDisplay;   // display campus (preserve case)
-    string deptLower;       // lowercase department
-    string deptDisplay;     // display department (preserve case)
-    sockaddr_in udpAddr;    // last known UDP address for broadcast
+    uint32_t conn = 0;           // connection number (capture traces)
+    uint32_t campus = NO_SYMBOL; // campus id, NO_SYMBOL until authenticated
+    uint32_t dept = NO_SYMBOL;   // department id
     bool has_udp_addr = false;
+    sockaddr_in udpAddr;         // last known UDP address for broadcast
+};
+
+struct ClientIo {
+    FrameReader in;         // partial frames received on sockfd
+    string out;             // frames queued for sockfd, written at the end of the loop turn
 };
 
 struct CampusStatus {
@@ -51,11 +88,56 @@ struct CampusStatus {
     bool online = false;
 };
 
+// Per-department session, kept across reconnects so replayed messages can be dropped
+struct SessionState {
+    string session;                          // id chosen by the client process (new on every client start)
+    unordered_map<uint64_t, uint64_t> lastSeq; // target route key -> highest conversation sequence number already processed
+    unordered_map<uint64_t, vector<uint64_t>> rejected; // same key -> processed seqs that were not routed (newest MAX_REJECTED)
+    unordered_map<uint64_t, FrameRing> unacked; // sender route key -> frames forwarded to this department, not yet acked (D)
+    bool live = false;                       // authenticated and not yet disconnected
+};
+static const size_t MAX_REJECTED = 256;      // rejected seqs remembered per conversation (a client's replay window)
+
+// Cumulative receipt for a sender: everything up to seq in one conversation
+struct Receipt {
+    char kind;            // S = accepted by server, D = delivered, R = read (X = rejected is sent on its own)
+    uint32_t campus, dept; // the conversation's other end
+    uint64_t seq;
+    uint64_t msgId;       // server id of the message at seq (0 if unknown)
+};
+
+// Routing log entry; the text line is only built when the log is shown or replicated
+struct LogEntry {
+    time_t ts;
+    char kind;            // M = routed message, F = routed file, T = free text
+    uint32_t fromCampus, fromDept, toCampus, toDept;
+    uint64_t msgId;
+    string_view text;     // body, filename or the whole line (kept in log_arena)
+};
+
 mutex global_mutex; // for shared access
-vector<ClientInfo> clients;
-map<string, int> routing_map;        // key = campusLower + "|" + deptLower -> index in clients
-map<string, CampusStatus> campusStatus;  // lowercase campus -> status
-vector<string> routing_log;
+vector<ClientInfo> clients;               // dense; a dropped client is swapped with the last one
+vector<ClientIo> client_io;               // same index as clients
+vector<int> client_slot;                  // sockfd -> index in clients, -1 if none
+unordered_map<uint64_t, int> routing_map; // route_key(campus, dept) -> client sockfd
+unordered_map<uint64_t, SessionState> sessions;  // same key -> session / duplicate filter
+static const size_t MAX_OUTBOX = 64 * 1024 * 1024; // per-client queued bytes before frames are dropped
+static const size_t MAX_FIELDS = 8;                // fields split off a client frame (the last keeps the rest)
+unordered_map<uint64_t, vector<Receipt>> pending_receipts; // sender key -> newest receipt per kind and conversation (kept across turns)
+vector<uint64_t> receipt_senders;                          // keys with receipts queued this turn
+// S receipts wait until the standby has acked the records they cover: a client
+// forgets a frame once it is accepted, so the standby must have it by then
+struct HeldReceipt {
+    uint64_t replSeq;     // last replication record queued when the receipt was made
+    uint64_t senderKey;
+    Receipt r;
+};
+vector<HeldReceipt> held_receipts; // oldest first, from held_head on (storage reused)
+size_t held_head = 0;
+uint64_t next_msg_id = 1;                                  // server-stamped message ids
+vector<CampusStatus> campusStatus;  // campus id -> status
+vector<LogEntry> routing_log;
+TextArena log_arena;
 
 // Heartbeat internal storage (lowercase campus -> heartbeat info)
 struct HeartbeatInfo {
@@ -65,6 +147,43 @@ struct HeartbeatInfo {
 mutex hb_mtx;
 map<string, HeartbeatInfo> heartbeats; // lowercase campus -> info
 
+// Replication (primary streams to a standby; a standby takes over when the link drops)
+bool standby_mode = false;
+ReplPrimary repl;
+ReplStandby standby;
+string primary_host;               // standby: primary to follow (--standby HOST:PORT)
+// Standby: the last complete state, set aside while a reconnect snapshot is
+// applied and restored if the link drops before its SNAPEND
+struct StandbyBackup {
+    bool held = false;
+    unordered_map<uint64_t, SessionState> sessions;
+    vector<LogEntry> routing_log;
+    TextArena log_arena;
+    uint64_t applied_seq = 0;
+};
+StandbyBackup standby_backup;
+int primary_repl_port = REPL_PORT;
+int tcp_port = TCP_PORT;           // client port (a primary sends it to its standby)
+
+// Attachments: content-addressed store, offers waiting for their blob's upload to finish
+struct WaitingOffer {
+    ClientInfo from;      // sender as it was when offering
+    uint64_t seq;
+    string targetCampus, targetDept, filename;
+};
+BlobStore blob_store;
+unordered_map<string, vector<WaitingOffer>> waiting_offers; // blob id -> offers
+
+// Traffic capture (--capture FILE): every inbound frame and datagram, replayable with ./replay
+Capture capture;
+uint32_t next_conn = 1;
+
+// I/O backend: poll() unless started with --io-uring and the kernel supports it
+bool use_uring = false;
+#ifdef USE_IO_URING
+UringReactor uring;
+#endif
+
 static string make_log(const string& s) {
     return "[" + now_str() + "] " + s;
 }
@@ -94,9 +213,10 @@ int set_nonblocking(int fd) {
 }
 
 // Called when heartbeat is received (campusLower expected)
-void on_heartbeat(const string &campusLower, const string &dept) {
+void on_heartbeat(const string &campusLower, const string &dept,
+                  chrono::system_clock::time_point ts = chrono::system_clock::now()) {
     lock_guard<mutex> lk(hb_mtx);
-    heartbeats[campusLower] = { dept, chrono::system_clock::now() };
+    heartbeats[campusLower] = { dept, ts };
 }
 
 // Menu option to view heartbeats
@@ -106,8 +226,8 @@ void show_heartbeat_log() {
     lock_guard<mutex> lk(hb_mtx);
     for (auto &p : heartbeats) {
         auto t = chrono::system_clock::to_time_t(p.second.ts);
-        string display = p.first;
-        if (campus_display_name.count(p.first)) display = campus_display_name[p.first];
+        uint32_t id = campuses.find(p.first);
+        string display = (id == NO_SYMBOL ? p.first : campuses.name(id));
         cout << display << " (" << p.second.dept << ") : " << ctime(&t);
     }
     cout << "---------------------------\n";
@@ -115,13 +235,372 @@ void show_heartbeat_log() {
     cin.ignore();
 }
 
-// send a TCP framed message (no newline expected)
+// send a TCP framed message (terminator is appended here)
 void send_tcp_msg(int sockfd, const string &msg) {
-    if (send(sockfd, msg.c_str(), msg.size(), 0) < 0) {
+    string out = frame(msg);
+    if (send(sockfd, out.c_str(), out.size(), MSG_NOSIGNAL) < 0) {
         // ignore send errors for now (client might have disconnected)
     }
 }
 
+const string &campus_name(uint32_t id) {
+    static const string unknown = "(Unknown)";
+    return id == NO_SYMBOL ? unknown : campuses.name(id);
+}
+const string &dept_name(uint32_t id) {
+    static const string none;
+    return id == NO_SYMBOL ? none : depts.name(id);
+}
+
+// Log line without the timestamp. Built in a buffer that the next call reuses
+// (so printing a routed message allocates nothing); copy it to keep it.
+const string &log_line(const LogEntry &e) {
+    static string line;
+    line.clear();
+    if (e.kind == 'T') return line.append(e.text);
+    line += (e.kind == 'F' ? "File routed #" : "Routed #");
+    line += to_string(e.msgId);
+    line += ' ';
+    line += campus_name(e.fromCampus); line += '-'; line += dept_name(e.fromDept);
+    line += " -> ";
+    line += campus_name(e.toCampus); line += '-'; line += dept_name(e.toDept);
+    line += " : ";
+    line += e.text;
+    return line;
+}
+
+// Same, with the timestamp (same reuse rule)
+const string &format_log(const LogEntry &e) {
+    static string line;
+    char ts[32];
+    strftime(ts, sizeof(ts), "[%F %T] ", localtime(&e.ts));
+    line.assign(ts);
+    line += log_line(e);
+    return line;
+}
+
+void log_text(string_view line, time_t ts = time(nullptr)) {
+    routing_log.push_back({ts, 'T', NO_SYMBOL, NO_SYMBOL, NO_SYMBOL, NO_SYMBOL, 0, log_arena.store(line)});
+}
+
+// Backend hooks: the poll loop rebuilds its fd set every turn, io_uring keeps registrations
+void io_add_client([[maybe_unused]] int fd) {
+#ifdef USE_IO_URING
+    if (use_uring) uring_add_client(uring, fd);
+#endif
+}
+
+void io_watch([[maybe_unused]] int fd) {
+#ifdef USE_IO_URING
+    if (use_uring) uring_watch_readable(uring, fd);
+#endif
+}
+
+// call before closing fd
+void io_forget([[maybe_unused]] int fd, [[maybe_unused]] bool client) {
+#ifdef USE_IO_URING
+    if (use_uring) uring_forget(uring, fd, client);
+#endif
+}
+
+int find_client(int sockfd) {
+    if (sockfd < 0 || (size_t)sockfd >= client_slot.size()) return -1;
+    return client_slot[sockfd];
+}
+
+// Queue a frame for a client; flush_outbound() writes it at the end of the turn
+void queue_frame(size_t ci_idx, string_view msg) {
+    string &out = client_io[ci_idx].out;
+    if (out.size() + msg.size() > MAX_OUTBOX) {
+        cout << make_log("Outbox full, dropping frame for fd=" + to_string(clients[ci_idx].sockfd)) << endl;
+        return;
+    }
+    out += msg;
+    out += FRAME_END;
+}
+
+// Keep only the newest cumulative receipt per sender, kind and conversation
+void add_receipt(uint64_t senderKey, char kind, uint32_t campus, uint32_t dept,
+                 uint64_t seq, uint64_t msgId) {
+    auto &list = pending_receipts[senderKey];
+    if (list.empty()) receipt_senders.push_back(senderKey);
+    for (auto &r : list) {
+        if (r.kind != kind || r.campus != campus || r.dept != dept) continue;
+        if (seq < r.seq) return;
+        r.seq = seq;
+        if (msgId) r.msgId = msgId;
+        return;
+    }
+    list.push_back({kind, campus, dept, seq, msgId});
+}
+
+// End of turn: piggyback coalesced receipts on each sender's queued frames as a
+// single "RCPT|Kind|Campus|Dept|Seq|MsgId[|...]" frame, then write every outbox.
+// Receipts for senders that are not connected here are dropped (they are cumulative).
+void flush_outbound() {
+    static string f;
+    for (uint64_t key : receipt_senders) {
+        auto &list = pending_receipts[key];
+        auto it = routing_map.find(key);
+        int i = (it == routing_map.end() ? -1 : find_client(it->second));
+        if (i >= 0) {
+            f = "RCPT";
+            for (auto &r : list) {
+                f += '|'; f += r.kind;
+                f += '|'; f += campuses.name(r.campus);
+                f += '|'; f += depts.name(r.dept);
+                f += '|'; f += to_string(r.seq);
+                f += '|'; f += to_string(r.msgId);
+            }
+            queue_frame(i, f);
+        }
+        list.clear(); // the entry (and its capacity) stays for the next turn
+    }
+    receipt_senders.clear();
+
+    for (size_t i = 0; i < clients.size(); ++i) {
+        string &out = client_io[i].out;
+#ifdef USE_IO_URING
+        if (use_uring) {
+            if (!out.empty() && !uring_send_busy(uring, clients[i].sockfd))
+                uring_send(uring, clients[i].sockfd, out);
+            continue;
+        }
+#endif
+        while (!out.empty()) {
+            ssize_t n = send(clients[i].sockfd, out.data(), out.size(), MSG_NOSIGNAL);
+            if (n <= 0) break; // EAGAIN: retry next turn (POLLOUT); errors show up on recv
+            out.erase(0, n);
+        }
+    }
+}
+
+// Queue a state change for the standby (no-op on a standby or without one)
+void replicate(string_view record) {
+    if (!standby_mode) repl_append(repl, record);
+}
+
+// Records name campuses and departments by display name; the standby interns them itself
+string route_names(uint64_t key) {
+    return campuses.name(key >> 32) + "|" + depts.name((uint32_t)key);
+}
+
+string session_record(uint64_t key, const SessionState &ss) {
+    return "SESS|" + route_names(key) + "|" + ss.session + "|" + (ss.live ? "1" : "0");
+}
+
+string log_record(const LogEntry &e) {
+    return "LOG|" + to_string(e.ts) + "|" + log_line(e);
+}
+
+// Full state for a freshly connected standby; later changes follow as records
+void repl_send_snapshot() {
+    repl_append(repl, "PORT|" + to_string(tcp_port));
+    for (auto &l : routing_log) repl_append(repl, log_record(l));
+    for (auto &p : sessions) {
+        repl_append(repl, session_record(p.first, p.second));
+        for (auto &c : p.second.lastSeq)
+            repl_append(repl, "CONV|" + route_names(p.first) + "|" + route_names(c.first) + "|" + to_string(c.second));
+        for (auto &c : p.second.rejected)
+            for (uint64_t seq : c.second)
+                repl_append(repl, "REJ|" + route_names(p.first) + "|" + route_names(c.first) + "|" + to_string(seq));
+        for (auto &u : p.second.unacked)
+            for (size_t i = 0; i < u.second.count; ++i) {
+                FrameRing::Slot &f = u.second.at(i);
+                repl_append(repl, "UNACK|" + route_names(p.first) + "|" + route_names(u.first) + "|" +
+                                  to_string(f.seq) + "|" + f.frame);
+            }
+    }
+    repl_append(repl, "MSGID|" + to_string(next_msg_id));
+    // attachments, complete or still uploading, as the PUT records an upload would produce
+    for (auto &p : blob_store.blobs)
+        for (size_t off = 0; off < p.second.data.size(); off += BLOB_CHUNK)
+            repl_append(repl, "PUT|" + p.first + "|" + to_string(off) + "|" +
+                              base64_encode(p.second.data.substr(off, BLOB_CHUNK)));
+    {
+        lock_guard<mutex> lk(hb_mtx);
+        for (auto &p : heartbeats)
+            repl_append(repl, "HB|" + p.first + "|" + p.second.dept + "|" +
+                              to_string(chrono::system_clock::to_time_t(p.second.ts)));
+    }
+    repl_append(repl, "SNAPEND");
+}
+
+// Note a processed seq that was not routed, so a replay of it is rejected again
+void remember_rejected(SessionState &ss, uint64_t targetKey, uint64_t seq) {
+    auto &v = ss.rejected[targetKey];
+    if (find(v.begin(), v.end(), seq) != v.end()) return;
+    if (v.size() >= MAX_REJECTED) v.erase(v.begin());
+    v.push_back(seq);
+}
+
+bool was_rejected(const SessionState &ss, uint64_t targetKey, uint64_t seq) {
+    auto it = ss.rejected.find(targetKey);
+    return it != ss.rejected.end() && find(it->second.begin(), it->second.end(), seq) != it->second.end();
+}
+
+// Routing log text of a forwarded frame: the body of a FROM, the filename of a FILEFROM / FILEREF
+string_view forward_text(string_view frame) {
+    string_view f[7];
+    size_t n = split_fields(frame, f, 7);
+    if (f[0] == "FROM") return rest_after(frame, 5);
+    return n > 5 ? f[5] : string_view();
+}
+
+// Route key for names received from the primary; campuses must be known here too
+uint64_t intern_route(const string &campus, const string &dept, bool *ok = nullptr) {
+    uint32_t c = campuses.find(campus);
+    if (ok) *ok = (c != NO_SYMBOL);
+    return route_key(c, depts.intern(dept));
+}
+
+// Standby: apply one record "R|<rseq>|<TYPE>|..." received from the primary
+void apply_repl_record(const string &rec) {
+    auto toks = split_tokens(rec, '|');
+    if (toks.size() < 3 || toks[0] != "R") return;
+    uint64_t seq = stoull(toks[1]);
+    const string &type = toks[2];
+    bool ok = true, ok2 = true;
+
+    if (type == "SESS" && toks.size() >= 7) {
+        uint64_t key = intern_route(toks[3], toks[4], &ok);
+        if (ok) {
+            SessionState &ss = sessions[key];
+            if (ss.session != toks[5]) { ss.session = toks[5]; ss.lastSeq.clear(); ss.rejected.clear(); }
+            ss.live = (toks[6] == "1");
+        }
+    } else if (type == "CONV" && toks.size() >= 8) {
+        // CONV|campus|dept|targetCampus|targetDept|seq
+        uint64_t key = intern_route(toks[3], toks[4], &ok);
+        uint64_t target = intern_route(toks[5], toks[6], &ok2);
+        if (ok && ok2) sessions[key].lastSeq[target] = stoull(toks[7]);
+    } else if (type == "REJ" && toks.size() >= 8) {
+        // REJ|campus|dept|targetCampus|targetDept|seq
+        uint64_t key = intern_route(toks[3], toks[4], &ok);
+        uint64_t target = intern_route(toks[5], toks[6], &ok2);
+        if (ok && ok2) remember_rejected(sessions[key], target, stoull(toks[7]));
+    } else if ((type == "DACK" || type == "UNACK") && toks.size() >= 8) {
+        // DACK|campus|dept|senderCampus|senderDept|seq: the department acked frames up to seq
+        // UNACK|campus|dept|senderCampus|senderDept|seq|<frame>: snapshot of one unacked frame
+        uint64_t key = intern_route(toks[3], toks[4], &ok);
+        uint64_t sender = intern_route(toks[5], toks[6], &ok2);
+        if (ok && ok2) {
+            FrameRing &ring = sessions[key].unacked[sender];
+            if (type == "DACK") ring.ack(stoull(toks[7]));
+            else ring.push(stoull(toks[7]), rest_after(rec, 8));
+        }
+    } else if (type == "PUT" && toks.size() >= 6) {
+        // PUT|BlobId|Offset|Base64: a chunk the primary stored
+        Blob *b = blob_open(blob_store, toks[3]);
+        if (b && blob_append(blob_store, toks[3], *b, stoull(toks[4]), base64_decode(rest_after(rec, 5))) &&
+            b->data.size() == b->size && !b->complete)
+            blob_erase(blob_store, toks[3]); // corrupted upload, dropped on the primary too
+    } else if (type == "SNAPEND") {
+        standby.snapshot_done = true;
+        standby_backup = StandbyBackup(); // the new state is complete
+    } else if (type == "PORT" && toks.size() >= 4) {
+        standby.primary_port = stoi(toks[3]);
+    } else if (type == "MSGID" && toks.size() >= 4) {
+        next_msg_id = max(next_msg_id, (uint64_t)stoull(toks[3]));
+    } else if (type == "MSG" && toks.size() >= 12) {
+        // MSG|campus|dept|session|targetCampus|targetDept|seq|msgId|kind|ts|<forwarded frame>
+        // (kind and frame are empty when the message could not be routed)
+        uint64_t key = intern_route(toks[3], toks[4], &ok);
+        uint64_t target = intern_route(toks[6], toks[7], &ok2);
+        if (ok && ok2) {
+            SessionState &ss = sessions[key];
+            if (ss.session != toks[5]) { ss.session = toks[5]; ss.lastSeq.clear(); ss.rejected.clear(); }
+            uint64_t &last = ss.lastSeq[target];
+            last = max(last, (uint64_t)stoull(toks[8]));
+            if (toks[10].empty()) remember_rejected(ss, target, stoull(toks[8]));
+        }
+        uint64_t msgId = stoull(toks[9]);
+        if (msgId) next_msg_id = max(next_msg_id, msgId + 1);
+        if (ok && ok2 && !toks[10].empty()) {
+            string_view fwd = rest_after(rec, 12);
+            sessions[target].unacked[key].push(stoull(toks[8]), fwd);
+            routing_log.push_back({(time_t)stoll(toks[11]), toks[10][0], (uint32_t)(key >> 32), (uint32_t)key,
+                                   (uint32_t)(target >> 32), (uint32_t)target, msgId,
+                                   log_arena.store(forward_text(fwd))});
+        }
+    } else if (type == "LOG" && toks.size() >= 5) {
+        log_text(rest_after(rec, 4), (time_t)stoll(toks[3]));
+    } else if (type == "HB" && toks.size() >= 6) {
+        time_t t = (time_t)stoll(toks[5]);
+        on_heartbeat(toks[3], toks[4], chrono::system_clock::from_time_t(t));
+        uint32_t c = campuses.find(toks[3]);
+        if (c != NO_SYMBOL) {
+            campusStatus[c].lastHeartbeat = t;
+            campusStatus[c].missedCount = 0;
+            campusStatus[c].online = true;
+        }
+    }
+    standby.applied_seq = seq;
+}
+
+// Forward a frame from senderKey (seq in that conversation) to the department
+// behind key. Sequenced frames are kept until the department acks them (D) and
+// sent again when it re-authenticates, so a session that is live but not
+// connected here (clients failing over after a takeover) gets them then.
+// Returns false if the target is offline or unknown.
+bool deliver(uint64_t key, uint64_t senderKey, uint64_t seq, string_view msg) {
+    auto it = routing_map.find(key);
+    auto ss = sessions.find(key);
+    bool live = ss != sessions.end() && ss->second.live;
+    if (it == routing_map.end() && !live) return false;
+    if (ss != sessions.end() && seq && (uint32_t)(senderKey >> 32) != NO_SYMBOL &&
+        !ss->second.unacked[senderKey].push(seq, msg))
+        cout << make_log("Unacked frames for " + route_names(key) + " from " + route_names(senderKey) +
+                         " dropped (limit or sender restarted)") << endl;
+    if (it != routing_map.end()) {
+        int i = find_client(it->second);
+        if (i >= 0) queue_frame(i, msg);
+    }
+    return true;
+}
+
+// The department behind key acked frames from senderKey up to seq (D)
+void ack_delivered(uint64_t key, uint64_t senderKey, uint64_t seq) {
+    auto ss = sessions.find(key);
+    if (ss == sessions.end()) return;
+    auto u = ss->second.unacked.find(senderKey);
+    if (u == ss->second.unacked.end() || !u->second.ack(seq)) return;
+    if (standby_mode || repl.standby_fd < 0) return;
+    static string rec; // reused: acks arrive with every batch of messages
+    rec = "DACK|";
+    rec += campuses.name(key >> 32); rec += '|'; rec += depts.name((uint32_t)key); rec += '|';
+    rec += campuses.name(senderKey >> 32); rec += '|'; rec += depts.name((uint32_t)senderKey); rec += '|';
+    rec += to_string(seq);
+    replicate(rec);
+}
+
+// Close a client connection and forget its routing entry. The last client
+// moves into the freed slot, so indexes above ci_idx are not stable across this.
+void drop_client(size_t ci_idx) {
+    auto &ci = clients[ci_idx];
+    io_forget(ci.sockfd, true);
+    close(ci.sockfd);
+    capture_record(capture, CAP_CLOSE, ci.conn, nullptr, 0);
+    if (ci.campus != NO_SYMBOL) {
+        uint64_t key = route_key(ci.campus, ci.dept);
+        auto it = routing_map.find(key);
+        if (it != routing_map.end() && it->second == ci.sockfd) {
+            routing_map.erase(it);
+            sessions[key].live = false;
+            replicate(session_record(key, sessions[key]));
+        }
+    }
+    client_slot[ci.sockfd] = -1;
+    size_t last = clients.size() - 1;
+    if (ci_idx != last) {
+        clients[ci_idx] = clients[last];
+        client_io[ci_idx] = move(client_io[last]);
+        client_slot[clients[ci_idx].sockfd] = (int)ci_idx;
+    }
+    clients.pop_back();
+    client_io.pop_back();
+}
+
 // ---------------- Admin Menu Thread ----------------
 void admin_menu(int udp_fd) {
     while (true) {
@@ -131,29 +610,50 @@ void admin_menu(int udp_fd) {
         cout << "3) LOG           - Show message routing log\n";
         cout << "4) HEARTBEAT LOG - Show heartbeat records\n";
         cout << "5) EXIT          - Shutdown server (notify clients)\n";
+        cout << "6) REPL          - Show replication status & lag\n";
+        cout << "7) FILES         - Show attachment store & dedup stats\n";
         cout << "Choose: ";
         string choice;
-        getline(cin, choice);
+        if (!getline(cin, choice)) return; // stdin closed (running headless)
 
         if (choice == "1") {
             lock_guard<mutex> lock(global_mutex);
             cout << "---- Connected department clients ----\n";
             for (auto &c : clients) {
-                string name = (c.campusDisplay.empty() ? "(unauthenticated)" : c.campusDisplay);
-                cout << "fd=" << c.sockfd << " : " << name << " / " << c.deptDisplay;
+                string name = (c.campus == NO_SYMBOL ? "(unauthenticated)" : campuses.name(c.campus));
+                cout << "fd=" << c.sockfd << " : " << name << " / " << dept_name(c.dept);
                 if (c.has_udp_addr) cout << " (udp-known)";
                 cout << "\n";
             }
             cout << "---- Heartbeat Status ----\n";
-            for (auto &cs : campusStatus) {
-                string display = cs.first;
-                if (campus_display_name.count(cs.first)) display = campus_display_name[cs.first];
-                cout << display << " : last HB " 
-                     << cs.second.lastHeartbeat 
+            for (uint32_t id = 0; id < campusStatus.size(); ++id) {
+                auto &cs = campusStatus[id];
+                cout << campuses.name(id) << " : last HB " 
+                     << cs.lastHeartbeat 
                      << "s ago, "
-                     << (cs.second.online ? "ONLINE" : "OFFLINE") 
+                     << (cs.online ? "ONLINE" : "OFFLINE") 
                      << "\n";
             }
+#ifdef USE_IO_URING
+            if (use_uring)
+                cout << "---- io_uring ----\n"
+                     << "io_uring_enter calls: " << uring.enters << ", completions: " << uring.completions
+                     << ", zero-copy sends: " << uring.zc_sends << "\n";
+#endif
+            if (capture.fd >= 0)
+                cout << "---- Capture ----\n" << capture.records << " records, " << capture.bytes << " bytes\n";
+            else if (capture.err)
+                cout << "---- Capture ----\nstopped: " << strerror(capture.err) << "\n";
+#ifdef COUNT_ALLOCS
+            static uint64_t last_allocs = 0, last_routed = 0;
+            uint64_t allocs = heap_allocs, routed = next_msg_id - 1;
+            cout << "---- Heap allocations (event loop) ----\n" << allocs << " total, " << (allocs - last_allocs)
+                 << " for the " << (routed - last_routed) << " messages routed since the last LIST";
+            if (routed > last_routed) cout << " (" << (double)(allocs - last_allocs) / (routed - last_routed) << " each)";
+            cout << "\n";
+            last_allocs = allocs;
+            last_routed = routed;
+#endif
         } else if (choice == "2") {
             cout << "Enter broadcast message: ";
             string msg;
@@ -171,7 +671,7 @@ void admin_menu(int udp_fd) {
         } else if (choice == "3") {
             lock_guard<mutex> lock(global_mutex);
             cout << "---- Routing Log ----\n";
-            for (auto &l : routing_log) cout << l << "\n";
+            for (auto &l : routing_log) cout << format_log(l) << "\n";
         } else if (choice == "4") {
             show_heartbeat_log();
         } else if (choice == "5") {
@@ -182,284 +682,812 @@ void admin_menu(int udp_fd) {
                 send_tcp_msg(ci.sockfd, shutdown_msg);
             }
             cout << make_log("Server shutting down (admin triggered). Notified clients.") << endl;
+            if (!capture_flush(capture, true))
+                cout << make_log(string("Capture stopped: write failed (") + strerror(capture.err) + ")") << endl;
             // Give a short moment for messages to be sent
             this_thread::sleep_for(chrono::milliseconds(200));
             exit(0);
+        } else if (choice == "6") {
+            lock_guard<mutex> lock(global_mutex);
+            cout << "---- Replication ----\n";
+            if (standby_mode) {
+                cout << "Role: standby, primary link "
+                     << (!standby.link_up ? "DOWN (taken over)" : standby.fd >= 0 ? "UP" : "reconnecting (primary up)") << "\n";
+                cout << "Applied records: " << standby.applied_seq << "\n";
+            } else {
+                cout << "Role: primary, standby " << (repl.standby_fd >= 0 ? "connected" : "not connected") << "\n";
+                cout << "Records sent: " << repl.records << " in " << repl.batches << " batches, acked up to "
+                     << repl.acked_seq << " of " << (repl.next_seq - 1) << "\n";
+                if (repl.lag_samples)
+                    cout << "Replication lag (us): last " << (long)repl.last_lag_us
+                         << ", avg " << (long)(repl.sum_lag_us / repl.lag_samples)
+                         << ", max " << (long)repl.max_lag_us << "\n";
+            }
+        } else if (choice == "7") {
+            lock_guard<mutex> lock(global_mutex);
+            size_t complete = 0;
+            for (auto &b : blob_store.blobs) complete += b.second.complete;
+            cout << "---- Attachments ----\n";
+            cout << "Blobs: " << complete << " stored, " << (blob_store.blobs.size() - complete) << " uploading, "
+                 << blob_store.bytes << " of " << BLOB_STORE_MAX << " bytes used, "
+                 << blob_store.evictions << " evicted, " << blob_store.expired << " uploads expired\n";
+            cout << "Offers: " << blob_store.offers << ", dedup hits: " << blob_store.dedup_hits
+                 << ", bytes saved by dedup: " << blob_store.bytes_saved << "\n";
+            cout << "Uploaded: " << blob_store.bytes_uploaded << " bytes, served: " << blob_store.bytes_served
+                 << " bytes in " << blob_store.chunks_served << " chunks\n";
         } else {
             cout << "Invalid option.\n";
         }
     }
 }
 
-int main() {
-    cout << make_log("Starting Central Server (poll-based)") << endl;
+// True if a conversation sequence number was processed before (a client
+// replaying its recent messages after failing over)
+bool seen_seq(const ClientInfo &ci, uint64_t targetKey, uint64_t seq) {
+    if (ci.campus == NO_SYMBOL || seq == 0) return false;
+    return seq <= sessions[route_key(ci.campus, ci.dept)].lastSeq[targetKey];
+}
 
-    // build lowercase -> proper case map and initialize campusStatus with lowercase keys
-    for (auto &p : credentials) {
-        string lc = to_lower(p.first);
-        campus_display_name[lc] = p.first;
-        campusStatus[lc] = CampusStatus();
+// Mark seq as processed once it has been routed (or rejected)
+void accept_seq(const ClientInfo &ci, uint64_t targetKey, uint64_t seq, bool routed) {
+    if (ci.campus == NO_SYMBOL || seq == 0) return;
+    SessionState &ss = sessions[route_key(ci.campus, ci.dept)];
+    uint64_t &last = ss.lastSeq[targetKey];
+    last = max(last, seq);
+    if (!routed) remember_rejected(ss, targetKey, seq);
+}
+
+// Replicate a processed message with the frame forwarded for it (e is null
+// when it could not be routed)
+void replicate_msg(const ClientInfo &ci, uint64_t targetKey, uint64_t seq, const LogEntry *e, string_view frame) {
+    if (standby_mode || repl.standby_fd < 0) return; // don't build records nobody reads
+    if (ci.campus == NO_SYMBOL || seq == 0) {
+        if (e) replicate(log_record(*e));
+        return;
     }
+    uint64_t key = route_key(ci.campus, ci.dept);
+    const SessionState &ss = sessions[key];
+    static string rec; // reused: no allocation per message once grown
+    rec = "MSG|";
+    rec += campuses.name(ci.campus); rec += '|'; rec += depts.name(ci.dept); rec += '|';
+    rec += ss.session; rec += '|';
+    rec += campuses.name(targetKey >> 32); rec += '|'; rec += depts.name((uint32_t)targetKey); rec += '|';
+    rec += to_string(seq); rec += '|';
+    if (e) {
+        rec += to_string(e->msgId); rec += '|'; rec += e->kind; rec += '|';
+        rec += to_string(e->ts); rec += '|'; rec += frame;
+    } else {
+        rec += "0|||";
+    }
+    replicate(rec);
+}
 
-    // TCP socket
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); return 1; }
+// Tell an authenticated sender that the server accepted seq (stamped msgId),
+// once a connected standby has everything replicated so far
+void receipt_accepted(const ClientInfo &ci, uint64_t targetKey, uint64_t seq, uint64_t msgId) {
+    if (ci.campus == NO_SYMBOL || seq == 0) return;
+    uint64_t sender = route_key(ci.campus, ci.dept);
+    if (!standby_mode && repl.standby_fd >= 0 && repl.acked_seq < repl.next_seq - 1) {
+        held_receipts.push_back({repl.next_seq - 1, sender, {'S', (uint32_t)(targetKey >> 32), (uint32_t)targetKey, seq, msgId}});
+        return;
+    }
+    add_receipt(sender, 'S', targetKey >> 32, (uint32_t)targetKey, seq, msgId);
+}
 
-    int opt = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Release held receipts the standby has caught up with (all of them without a standby)
+void release_receipts() {
+    bool all = standby_mode || repl.standby_fd < 0;
+    for (; held_head < held_receipts.size(); ++held_head) {
+        HeldReceipt &h = held_receipts[held_head];
+        if (!all && h.replSeq > repl.acked_seq) break;
+        add_receipt(h.senderKey, h.r.kind, h.r.campus, h.r.dept, h.r.seq, h.r.msgId);
+    }
+    if (held_head == held_receipts.size()) {
+        held_receipts.clear();
+        held_head = 0;
+    }
+}
 
-    sockaddr_in srvAddr{};
-    srvAddr.sin_family = AF_INET;
-    srvAddr.sin_port = htons(TCP_PORT);
-    srvAddr.sin_addr.s_addr = INADDR_ANY;
+// Route key for a target named in a frame, looked up without allocating;
+// false if that campus or department has never authenticated
+bool find_target(string_view campus, string_view dept, uint64_t &key) {
+    uint32_t c = campuses.find(campus), d = depts.find(dept);
+    if (c == NO_SYMBOL || d == NO_SYMBOL) return false;
+    key = route_key(c, d);
+    return true;
+}
 
-    if (bind(listen_fd, (sockaddr*)&srvAddr, sizeof(srvAddr)) < 0) { perror("bind"); return 1; }
-    if (listen(listen_fd, 50) < 0) { perror("listen"); return 1; }
+// Queue a frame for the client ci refers to, if it is still connected
+void queue_to(const ClientInfo &ci, string_view msg) {
+    int i = find_client(ci.sockfd);
+    if (i >= 0 && clients[i].campus == ci.campus && clients[i].dept == ci.dept) queue_frame(i, msg);
+}
 
-    set_nonblocking(listen_fd);
+// Tell a sender that seq was not routed: "RCPT|X|Campus|Dept|Seq|0" (never
+// coalesced, the client drops that frame from its replay window) after the
+// ERR text. why is empty when the sender has been told already (a replay).
+void reject_frame(const ClientInfo &ci, uint64_t seq, string_view targetCampus, string_view targetDept,
+                  const string &why) {
+    if (!why.empty()) queue_to(ci, "ERR|" + why);
+    if (ci.campus == NO_SYMBOL || seq == 0) return;
+    queue_to(ci, "RCPT|X|" + string(targetCampus) + "|" + string(targetDept) + "|" + to_string(seq) + "|0");
+}
 
-    // UDP socket
-    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_fd < 0) { perror("udp socket"); return 1; }
+// Shared by MSG, FILE and OFFER (type): dedupe, stamp an id, forward and log.
+// text is the body or filename for the log. ci may be a copy of a client
+// that has disconnected since (an offer completed by someone else's upload).
+void route_frame(const ClientInfo &ci, string_view type, uint64_t seq, string_view targetRaw,
+                 string_view targetDeptRaw, string_view payload, string_view text) {
+    char kind = (type == "MSG" ? 'M' : 'F');
+    const char *fwd = (type == "MSG" ? "FROM|" : type == "FILE" ? "FILEFROM|" : "FILEREF|");
+    uint64_t key = 0;
+    bool known = find_target(targetRaw, targetDeptRaw, key);
 
-    sockaddr_in udpAddr{};
-    udpAddr.sin_family = AF_INET;
-    udpAddr.sin_port = htons(UDP_PORT);
-    udpAddr.sin_addr.s_addr = INADDR_ANY;
+    if (known && seen_seq(ci, key, seq)) {
+        cout << make_log("Dropped duplicate " + string(type) + " seq=" + to_string(seq) +
+                         " from fd=" + to_string(ci.sockfd)) << endl;
+        if (was_rejected(sessions[route_key(ci.campus, ci.dept)], key, seq))
+            reject_frame(ci, seq, targetRaw, targetDeptRaw, "");
+        else
+            receipt_accepted(ci, key, seq, 0);
+        return;
+    }
 
-    if (bind(udp_fd, (sockaddr*)&udpAddr, sizeof(udpAddr)) < 0) { perror("udp bind"); return 1; }
-    set_nonblocking(udp_fd);
+    uint64_t msgId = next_msg_id;
+    static string forward; // reused: routing a frame allocates nothing once it has grown
+    forward = fwd;
+    forward += to_string(msgId); forward += '|';
+    forward += to_string(seq); forward += '|';
+    forward += campus_name(ci.campus); forward += '|';
+    forward += dept_name(ci.dept); forward += '|';
+    forward += payload;
+
+    if (known && deliver(key, route_key(ci.campus, ci.dept), seq, forward)) {
+        accept_seq(ci, key, seq, true);
+        next_msg_id++;
+        routing_log.push_back({time(nullptr), kind, ci.campus, ci.dept, (uint32_t)(key >> 32), (uint32_t)key,
+                               msgId, log_arena.store(text)});
+        const LogEntry &e = routing_log.back();
+        replicate_msg(ci, key, seq, &e, forward);
+        receipt_accepted(ci, key, seq, msgId);
+        cout << format_log(e) << endl;
+    } else {
+        if (known) {
+            accept_seq(ci, key, seq, false);
+            replicate_msg(ci, key, seq, nullptr, {});
+        }
+        reject_frame(ci, seq, targetRaw, targetDeptRaw,
+                     "Target offline or unknown: " + string(targetRaw) + "-" + string(targetDeptRaw));
+    }
+}
 
-    cout << make_log("TCP port: " + to_string(TCP_PORT) + ", UDP port: " + to_string(UDP_PORT)) << endl;
+// Forward an attachment the store has as "FILEREF|MsgId|Seq|Campus|Dept|Filename|BlobId|Size"
+void route_offer(const ClientInfo &from, uint64_t seq, string_view targetCampus, string_view targetDept,
+                 string_view filename, const string &id) {
+    string payload(filename);
+    payload += '|'; payload += id;
+    payload += '|'; payload += to_string(blob_id_size(id));
+    route_frame(from, "OFFER", seq, targetCampus, targetDept, payload, filename);
+}
 
-    // Start admin thread
-    thread(admin_menu, udp_fd).detach();
+// OFFER|Seq|TargetCampus|TargetDept|Filename|BlobId: route right away if the
+// blob is stored (dedup hit), otherwise ask for it with "NEED|BlobId|Offset"
+void handle_offer(size_t ci_idx, const string_view *toks) {
+    const ClientInfo &ci = clients[ci_idx];
+    uint64_t seq = to_u64(toks[1]);
+    string id(toks[5]);
+    uint64_t key;
+    if (find_target(toks[2], toks[3], key) && ci.campus != NO_SYMBOL && seq &&
+        seq <= sessions[route_key(ci.campus, ci.dept)].lastSeq[key]) {
+        route_offer(ci, seq, toks[2], toks[3], toks[4], id); // replay: dropped there, receipt resent
+        return;
+    }
+    Blob *b = blob_open(blob_store, id);
+    if (!b) {
+        reject_frame(ci, seq, toks[2], toks[3], "Attachment too large or malformed: " + string(toks[4]));
+        return;
+    }
+    blob_store.offers++;
+    if (b->complete) {
+        blob_store.dedup_hits++;
+        blob_store.bytes_saved += b->size;
+        route_offer(ci, seq, toks[2], toks[3], toks[4], id);
+        return;
+    }
+    auto &w = waiting_offers[id];
+    bool dup = false;
+    for (auto &o : w)
+        dup |= (o.from.campus == ci.campus && o.from.dept == ci.dept && o.seq == seq &&
+                o.targetCampus == toks[2] && o.targetDept == toks[3]);
+    if (!dup) w.push_back({ci, seq, string(toks[2]), string(toks[3]), string(toks[4])});
+    queue_frame(ci_idx, "NEED|" + id + "|" + to_string(b->data.size()));
+}
 
-    // Main poll loop
-    while (true) {
-        vector<pollfd> pfds;
+// PUT|BlobId|Offset|Base64: next chunk of an upload; a finished upload
+// releases every offer waiting for that blob
+void handle_put(size_t ci_idx, string_view msg, const string_view *toks) {
+    string id(toks[1]);
+    uint64_t offset = to_u64(toks[2]);
+    Blob *b = blob_open(blob_store, id);
+    if (!b) return;
+    size_t had = b->data.size();
+    if (!blob_append(blob_store, id, *b, offset, base64_decode(rest_after(msg, 3)))) {
+        queue_frame(ci_idx, "NEED|" + id + "|" + to_string(b->data.size())); // gap: resume from here
+        return;
+    }
+    if (b->data.size() > had) replicate(msg); // the standby keeps the same blobs
+
+    if (b->data.size() < b->size) return;
+
+    vector<WaitingOffer> w;
+    auto it = waiting_offers.find(id);
+    if (it != waiting_offers.end()) { w.swap(it->second); waiting_offers.erase(it); }
+    if (!b->complete) {
+        blob_erase(blob_store, id);
+        for (auto &o : w)
+            reject_frame(o.from, o.seq, o.targetCampus, o.targetDept, "Attachment corrupted in transfer: " + o.filename);
+        return;
+    }
+    for (auto &o : w) route_offer(o.from, o.seq, o.targetCampus, o.targetDept, o.filename, id);
+}
 
+// GET|BlobId|Offset|Length: one "DATA|BlobId|Offset|Base64" chunk (at most
+// BLOB_CHUNK bytes), or "NOBLOB|BlobId" if the store does not have it
+void handle_get(size_t ci_idx, const string_view *toks) {
+    string id(toks[1]);
+    uint64_t offset = to_u64(toks[2]);
+    uint64_t len = min<uint64_t>(to_u64(toks[3]), BLOB_CHUNK);
+    Blob *b = blob_find(blob_store, id);
+    if (!b || !b->complete || offset > b->size) {
+        queue_frame(ci_idx, "NOBLOB|" + id);
+        return;
+    }
+    len = min<uint64_t>(len, b->size - offset);
+    queue_frame(ci_idx, "DATA|" + id + "|" + to_string(offset) + "|" + base64_encode(b->data.substr(offset, len)));
+    blob_store.bytes_served += len;
+    blob_store.chunks_served++;
+}
+// Drop stalled uploads and fail the offers that were waiting for them (also
+// those whose upload was pushed out by BLOB_MAX_UPLOADING)
+void expire_uploads(time_t now) {
+    blob_expire(blob_store, now);
+    for (auto it = waiting_offers.begin(); it != waiting_offers.end();) {
+        if (blob_store.blobs.count(it->first)) { ++it; continue; }
+        for (auto &o : it->second)
+            reject_frame(o.from, o.seq, o.targetCampus, o.targetDept, "Attachment upload expired: " + o.filename);
+        it = waiting_offers.erase(it);
+    }
+}
+
+// Handle one frame from clients[ci_idx]. msg and the fields split from it are
+// views into the client's receive buffer; nothing is copied unless kept.
+// Returns false if the client was dropped.
+bool handle_client_frame(size_t ci_idx, string_view msg) {
+    auto &ci = clients[ci_idx];
+    string_view toks[MAX_FIELDS];
+    size_t nt = split_fields(msg, toks, MAX_FIELDS);
+
+    // AUTH handling (AUTH|Campus|Dept|Pass|Session)
+    if (toks[0]=="AUTH" && nt>=4) {
+        string_view inputDept = toks[2];
+        string_view pass = toks[3];
+        string_view session = (nt>=5 ? toks[4] : string_view());
+        uint32_t campus = campuses.find(toks[1]);
+
+        if (standby_mode && standby.link_up) {
+            // the primary is still alive; send the client back to it
+            send_tcp_msg(ci.sockfd, "AUTH_FAIL|standby");
+            cout << make_log("Standby refused AUTH while primary is up (fd=" + to_string(ci.sockfd) + ")") << endl;
+            drop_client(ci_idx);
+            return false;
+        }
+
+        if (campus != NO_SYMBOL && campus_password[campus] == pass) {
+            // success
+            ci.campus = campus;
+            ci.dept = depts.intern(inputDept);
+            uint64_t key = route_key(ci.campus, ci.dept);
+            routing_map[key] = ci.sockfd;
+            SessionState &ss = sessions[key];
+            if (ss.session != session) { ss.session = session; ss.lastSeq.clear(); ss.rejected.clear(); }
+            ss.live = true;
+            replicate(session_record(key, ss));
+            queue_frame(ci_idx, "AUTH_OK");
+            log_text("AUTH " + campus_name(ci.campus) + " / " + dept_name(ci.dept));
+            replicate(log_record(routing_log.back()));
+            cout << make_log("Authenticated: " + campus_name(ci.campus) + " / " + dept_name(ci.dept) +
+                             " (fd="+to_string(ci.sockfd)+")") << endl;
+
+            // frames it has not acked: sent while it was failing over, or lost with
+            // the old connection (the client drops the ones it has seen)
+            for (auto &u : ss.unacked)
+                for (size_t i = 0; i < u.second.count; ++i) queue_frame(ci_idx, u.second.at(i).frame);
+            if (standby_mode && !standby.first_auth_logged) {
+                standby.first_auth_logged = true;
+                auto ms = chrono::duration_cast<chrono::milliseconds>(
+                    chrono::steady_clock::now() - standby.takeover_at).count();
+                cout << make_log("First client re-authenticated " + to_string(ms) + " ms after takeover") << endl;
+            }
+        } else {
+            send_tcp_msg(ci.sockfd, "AUTH_FAIL");
+            log_text("AUTH_FAIL fd="+to_string(ci.sockfd));
+            cout << make_log("Authentication failed for fd=" + to_string(ci.sockfd)) << endl;
+            drop_client(ci_idx);
+            return false;
+        }
+    }
+    // MSG handling: MSG|Seq|TargetCampus|TargetDept|Body  (Seq counts per sender -> target conversation)
+    else if (toks[0]=="MSG" && nt>=5) {
+        string_view body = rest_after(msg, 4);
+        route_frame(ci, "MSG", to_u64(toks[1]), toks[2], toks[3], body, body);
+    }
+    // FILE handling: FILE|Seq|TargetCampus|TargetDept|Filename|Base64Content
+    else if (toks[0]=="FILE" && nt>=6) {
+        // everything after the 4th '|' is filename|base64 content
+        route_frame(ci, "FILE", to_u64(toks[1]), toks[2], toks[3], rest_after(msg, 4), toks[4]);
+    }
+    // Attachments (authenticated clients only): OFFER, PUT, GET
+    else if ((toks[0]=="OFFER" && nt>=6) || (toks[0]=="PUT" && nt>=4) || (toks[0]=="GET" && nt>=4)) {
+        if (ci.campus == NO_SYMBOL) queue_frame(ci_idx, "ERR|Not authenticated");
+        else if (toks[0]=="OFFER") handle_offer(ci_idx, toks);
+        else if (toks[0]=="PUT") handle_put(ci_idx, msg, toks);
+        else handle_get(ci_idx, toks);
+    }
+    // PING: a standby checking that this server is still serving clients
+    else if (toks[0]=="PING") {
+        queue_frame(ci_idx, "PONG");
+    }
+    // ACK handling: ACK|Kind|FromCampus|FromDept|Seq|MsgId[|Kind|...]
+    // Kind D = delivered, R = read; each group is cumulative for that conversation
+    else if (toks[0]=="ACK") {
+        if (ci.campus == NO_SYMBOL) return true;
+        string_view rest = rest_after(msg, 1), g[6]; // g[5]: the groups after this one
+        size_t n;
+        while ((n = split_fields(rest, g, 6)) >= 5) {
+            rest = (n == 6 ? g[5] : string_view());
+            if (g[0] != "D" && g[0] != "R") continue;
+            uint64_t senderKey;
+            if (!find_target(g[1], g[2], senderKey)) continue;
+            add_receipt(senderKey, g[0][0], ci.campus, ci.dept, to_u64(g[3]), to_u64(g[4]));
+            if (g[0] == "D") ack_delivered(route_key(ci.campus, ci.dept), senderKey, to_u64(g[3]));
+        }
+    }
+    else {
+        cout << make_log("Unknown TCP payload from fd="+to_string(ci.sockfd)+" -> "+string(msg)) << endl;
+    }
+    return true;
+}
+
+// ---------------- Event handlers (shared by the poll and io_uring loops) ----------------
+// All of them run with global_mutex held.
+
+void on_client_accepted(int clientfd) {
+    set_nonblocking(clientfd);
+    ClientInfo ci; ci.sockfd = clientfd; ci.conn = next_conn++;
+    capture_record(capture, CAP_OPEN, ci.conn, nullptr, 0);
+    if ((size_t)clientfd >= client_slot.size()) client_slot.resize(clientfd + 1, -1);
+    client_slot[clientfd] = (int)clients.size();
+    clients.push_back(ci);
+    client_io.emplace_back();
+    io_add_client(clientfd);
+    log_text("Client connected fd=" + to_string(clientfd));
+    cout << make_log("New TCP client connected (fd=" + to_string(clientfd) + ")") << endl;
+}
+
+// Bytes (or EOF/error when r <= 0) from a client socket
+void on_client_data(int fd, const char *buf, ssize_t r) {
+    int ci_idx = find_client(fd);
+    if (ci_idx < 0) return; // dropped earlier in this turn
+    FrameReader &in = client_io[ci_idx].in;
+    if (r <= 0 || (in.feed(buf, r), in.overflowed())) {
+        cout << make_log("Client fd=" + to_string(fd)+" disconnected") << endl;
+        log_text("fd "+to_string(fd)+" disconnected");
+        drop_client(ci_idx);
+        return;
+    }
+    string_view msg;
+    while (client_io[ci_idx].in.next(msg)) {
+        capture_record(capture, CAP_FRAME, clients[ci_idx].conn, msg.data(), msg.size());
+        if (!handle_client_frame(ci_idx, msg)) break;
+    }
+}
+
+// Heartbeats; drains the socket since io_uring only reports new readiness
+void on_udp_readable(int udp_fd) {
+    char buf[BUFFER_SIZE]; sockaddr_in src; socklen_t sl = sizeof(src);
+    ssize_t r;
+    while ((r = recvfrom(udp_fd, buf, sizeof(buf)-1, 0, (sockaddr*)&src, &sl)) > 0) {
+        capture_record(capture, CAP_UDP, 0, buf, r);
+        buf[r] = 0;
+        string s(buf);
+        auto toks = split_tokens(s,'|');
+        if (!toks.empty() && toks[0]=="HB" && toks.size()>=2) {
+            string campusLower = to_lower(toks[1]);
+            string dept = (toks.size()>=3 ? toks[2] : "");
+            on_heartbeat(campusLower, dept);
+
+            uint32_t campus = campuses.find(toks[1]);
+            if (campus != NO_SYMBOL) {
+                campusStatus[campus].lastHeartbeat = time(nullptr);
+                campusStatus[campus].missedCount = 0;
+                campusStatus[campus].online = true;
+            }
+            replicate("HB|" + campusLower + "|" + dept + "|" + to_string(time(nullptr)));
+            // update udp addr for any clients that match campus (we don't have dept in HB reliably)
+            for (size_t i=0;i<clients.size();++i) {
+                if (campus != NO_SYMBOL && clients[i].campus == campus) {
+                    clients[i].udpAddr = src;
+                    clients[i].has_udp_addr = true;
+                }
+            }
+        }
+        sl = sizeof(src);
+    }
+}
+
+// Standby: start serving clients with the state replicated so far
+void standby_take_over() {
+    standby.link_up = false;
+    standby.takeover_at = chrono::steady_clock::now();
+    log_text("Primary lost, standby taking over at record " + to_string(standby.applied_seq));
+    cout << format_log(routing_log.back()) << endl;
+}
+
+// Standby: the replication link dropped. Only a primary that stopped
+// answering on its client port is dead; one that cut us (we fell too far
+// behind) or restarted its link gets a reconnect, with a fresh snapshot.
+void standby_link_lost() {
+    if (!standby.snapshot_done && standby_backup.held) {
+        // the snapshot was cut short: go back to the last complete state
+        sessions = move(standby_backup.sessions);
+        routing_log = move(standby_backup.routing_log);
+        log_arena = move(standby_backup.log_arena);
+        standby.applied_seq = standby_backup.applied_seq;
+        standby_backup = StandbyBackup();
+        standby.snapshot_done = true;
+        cout << make_log("Snapshot incomplete, keeping the state from before the reconnect") << endl;
+    }
+    if (!repl_primary_alive(primary_host, standby.primary_port)) {
+        standby_take_over();
+        return;
+    }
+    cout << make_log("Replication link lost but the primary is up; reconnecting") << endl;
+    standby.retry_at = chrono::steady_clock::now();
+}
+
+// Standby: reconnect to a live primary. The state it had is set aside while the
+// new snapshot comes in, and comes back if the link drops before SNAPEND.
+void standby_reconnect() {
+    int fd = repl_connect(primary_host, primary_repl_port);
+    if (fd < 0) {
+        if (!repl_primary_alive(primary_host, standby.primary_port)) { standby_take_over(); return; }
+        standby.retry_at = chrono::steady_clock::now() + chrono::milliseconds(REPL_RETRY_MS);
+        return;
+    }
+    standby_backup.held = true;
+    standby_backup.sessions = move(sessions);
+    standby_backup.routing_log = move(routing_log);
+    standby_backup.log_arena = move(log_arena);
+    standby_backup.applied_seq = standby.applied_seq;
+    sessions.clear();
+    routing_log.clear();
+    log_arena = TextArena();
+    standby.in = FrameReader();
+    standby.applied_seq = 0;
+    standby.snapshot_done = false;
+    standby.fd = fd;
+    io_watch(fd);
+    cout << make_log("Reconnected to primary at " + primary_host + ":" + to_string(primary_repl_port) +
+                     ", waiting for a snapshot") << endl;
+}
+
+void drop_standby_link() {
+    io_forget(repl.standby_fd, false);
+    repl_reset_link(repl);
+}
+
+// Standby connecting to us
+void on_repl_listen_readable() {
+    int fd;
+    while ((fd = accept(repl.listen_fd, nullptr, nullptr)) >= 0) {
+        if (repl.standby_fd >= 0) {
+            close(fd); // only one standby at a time
+            continue;
+        }
+        set_nonblocking(fd);
+        repl_reset_link(repl);
+        repl.standby_fd = fd;
+        io_watch(fd);
+        repl_send_snapshot();
+        repl.snapshot_left = repl.outbuf.size();
+        cout << make_log("Standby connected, snapshot of " + to_string(sessions.size()) + " sessions queued") << endl;
+    }
+}
+
+// Peer link: acks on a primary, records on a standby
+void on_repl_peer_readable() {
+    char buf[BUFFER_SIZE];
+    string f;
+    if (standby_mode) {
+        if (standby.fd < 0) return;
+        ssize_t r;
+        bool got = false;
+        while ((r = recv(standby.fd, buf, sizeof(buf), 0)) > 0) {
+            standby.in.feed(buf, r);
+            while (standby.in.next(f)) apply_repl_record(f);
+            got = true;
+        }
+        if (got && standby.snapshot_done) repl_send_ack(standby); // one cumulative ack per received batch
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            io_forget(standby.fd, false);
+            close(standby.fd);
+            standby.fd = -1;
+            standby_link_lost();
+        }
+    } else {
+        if (repl.standby_fd < 0) return;
+        ssize_t r;
+        while ((r = recv(repl.standby_fd, buf, sizeof(buf), 0)) > 0) {
+            repl.in.feed(buf, r);
+            while (repl.in.next(f)) {
+                auto t = split_tokens(f, '|');
+                if (t.size() >= 2 && t[0] == "REPL_ACK") repl_on_ack(repl, stoull(t[1]));
+            }
+        }
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            drop_standby_link();
+            cout << make_log("Standby disconnected") << endl;
+        }
+    }
+}
+
+void end_of_turn() {
+    // --- Outbound: one write per client per turn (receipts piggybacked) ---
+    release_receipts();
+    flush_outbound();
+
+    if (!capture_flush(capture, false))
+        cout << make_log(string("Capture stopped: write failed (") + strerror(capture.err) + ")") << endl;
+
+    // --- Replication: ship this turn's records as one batch ---
+    if (!standby_mode && !repl_flush(repl)) {
+        drop_standby_link();
+        cout << make_log("Standby link lost (send failed or backlog too large)") << endl;
+    }
+    if (standby_mode && standby.link_up && standby.fd < 0 && chrono::steady_clock::now() >= standby.retry_at)
+        standby_reconnect();
+
+    time_t now = time(nullptr);
+    static time_t last_expiry = 0;
+    if (now != last_expiry) {
+        last_expiry = now;
+        expire_uploads(now);
+    }
+
+    // --- Heartbeat monitoring (mark offline if missed MAX_MISSED_HEARTBEATS) ---
+    for (uint32_t id = 0; id < campusStatus.size(); ++id) {
+        auto &cs = campusStatus[id];
+        if (cs.online) {
+            double diff = difftime(now, cs.lastHeartbeat);
+            if (diff > HEARTBEAT_INTERVAL) {
+                cs.missedCount++;
+                if (cs.missedCount >= MAX_MISSED_HEARTBEATS) {
+                    cs.online = false;
+                    cout << make_log(campuses.name(id) + " marked OFFLINE due to missed heartbeats") << endl;
+                }
+            }
+        }
+    }
+}
+
+// Readiness loop: poll() over all sockets, then one recv() per readable client
+void poll_loop(int listen_fd, int udp_fd) {
+    vector<pollfd> pfds; // rebuilt every turn, storage kept
+    while (true) {
+        pfds.clear();
         pfds.push_back({listen_fd, POLLIN, 0});
         pfds.push_back({udp_fd, POLLIN, 0});
+        pfds.push_back({repl.listen_fd, POLLIN, 0});                              // -1 on a standby
+        pfds.push_back({standby_mode ? standby.fd : repl.standby_fd, POLLIN, 0}); // -1 when no peer
 
         {
             lock_guard<mutex> lock(global_mutex);
-            for (auto &ci : clients)
-                pfds.push_back({ci.sockfd, POLLIN, 0});
+            for (size_t i = 0; i < clients.size(); ++i)
+                pfds.push_back({clients[i].sockfd, (short)(client_io[i].out.empty() ? POLLIN : POLLIN | POLLOUT), 0});
         }
 
         int n = poll(pfds.data(), pfds.size(), 1000);
         if (n < 0) { perror("poll"); continue; }
 
-        int idx = 0;
+        lock_guard<mutex> lock(global_mutex);
 
         // --- TCP listen ---
-        if (pfds[idx].revents & POLLIN) {
+        if (pfds[0].revents & POLLIN) {
             sockaddr_in cliAddr; socklen_t len = sizeof(cliAddr);
             int clientfd = accept(listen_fd, (sockaddr*)&cliAddr, &len);
-            if (clientfd >= 0) {
-                set_nonblocking(clientfd);
-                ClientInfo ci; ci.sockfd = clientfd;
-                lock_guard<mutex> lock(global_mutex);
-                clients.push_back(ci);
-                routing_log.push_back(make_log("Client connected fd=" + to_string(clientfd)));
-                cout << make_log("New TCP client connected (fd=" + to_string(clientfd) + ")") << endl;
-            }
+            if (clientfd >= 0) on_client_accepted(clientfd);
         }
-        idx++;
 
         // --- UDP (heartbeat) ---
-        if (pfds[idx].revents & POLLIN) {
-            char buf[BUFFER_SIZE]; sockaddr_in src; socklen_t sl = sizeof(src);
-            ssize_t r = recvfrom(udp_fd, buf, sizeof(buf)-1, 0, (sockaddr*)&src, &sl);
-            if (r > 0) {
-                buf[r] = 0;
-                string s(buf);
-                auto toks = split_tokens(s,'|');
-                if (!toks.empty() && toks[0]=="HB" && toks.size()>=2) {
-                    string campusLower = to_lower(toks[1]);
-                    string dept = (toks.size()>=3 ? toks[2] : "");
-                    on_heartbeat(campusLower, dept);
-
-                    lock_guard<mutex> lock(global_mutex);
-                    if (campusStatus.count(campusLower)) {
-                        campusStatus[campusLower].lastHeartbeat = time(nullptr);
-                        campusStatus[campusLower].missedCount = 0;
-                        campusStatus[campusLower].online = true;
-                    }
-                    // update udp addr for any clients that match campus (we don't have dept in HB reliably)
-                    for (size_t i=0;i<clients.size();++i) {
-                        if (clients[i].campusLower == campusLower) {
-                            clients[i].udpAddr = src;
-                            clients[i].has_udp_addr = true;
-                        }
-                    }
-                }
-            }
-        }
-        idx++;
+        if (pfds[1].revents & POLLIN) on_udp_readable(udp_fd);
+
+        // --- Replication ---
+        if (pfds[2].revents & POLLIN) on_repl_listen_readable();
+        if (pfds[3].revents & (POLLIN | POLLHUP | POLLERR)) on_repl_peer_readable();
 
         // --- Client sockets ---
-        lock_guard<mutex> lock(global_mutex);
-        for (size_t ci_idx=0; ci_idx<clients.size(); ++ci_idx, ++idx) {
-            auto &ci = clients[ci_idx];
-            if (!(pfds[idx].revents & POLLIN)) continue;
-            char buf[BUFFER_SIZE]; ssize_t r = recv(ci.sockfd, buf, sizeof(buf)-1, 0);
-            if (r <= 0) {
-                cout << make_log("Client fd=" + to_string(ci.sockfd)+" disconnected") << endl;
-                routing_log.push_back(make_log("fd "+to_string(ci.sockfd)+" disconnected"));
-                close(ci.sockfd);
-                // remove routing_map entry for this client
-                if (!ci.campusLower.empty() && !ci.deptLower.empty()) {
-                    string key = ci.campusLower + "|" + ci.deptLower;
-                    if (routing_map.count(key)) routing_map.erase(key);
-                }
-                clients.erase(clients.begin()+ci_idx);
-                ci_idx--;
-                idx--;
-                continue;
-            }
-            buf[r] = 0;
-            string msg(buf);
-            auto toks = split_tokens(msg,'|');
-            if (toks.empty()) continue;
-
-            // AUTH handling (AUTH|Campus|Dept|Pass)
-            if (toks[0]=="AUTH" && toks.size()>=4) {
-                string inputCamp = toks[1];
-                string inputDept = toks[2];
-                string pass = toks[3];
-                string inputLower = to_lower(inputCamp);
-                string deptLower = to_lower(inputDept);
-
-                if (campus_display_name.count(inputLower) && credentials[campus_display_name[inputLower]] == pass) {
-                    // success
-                    ci.campusLower = inputLower;
-                    ci.campusDisplay = campus_display_name[inputLower];
-                    ci.deptLower = deptLower;
-                    ci.deptDisplay = inputDept;
-                    string key = ci.campusLower + "|" + ci.deptLower;
-                    routing_map[key] = ci_idx;
-                    string reply = "AUTH_OK";
-                    if (send(ci.sockfd, reply.c_str(), reply.size(),0)<0) perror("send");
-                    routing_log.push_back(make_log("AUTH " + ci.campusDisplay + " / " + ci.deptDisplay));
-                    cout << make_log("Authenticated: " + ci.campusDisplay + " / " + ci.deptDisplay + " (fd="+to_string(ci.sockfd)+")") << endl;
-                } else {
-                    string reply = "AUTH_FAIL";
-                    if (send(ci.sockfd, reply.c_str(), reply.size(),0)<0) perror("send");
-                    routing_log.push_back(make_log("AUTH_FAIL fd="+to_string(ci.sockfd)));
-                    cout << make_log("Authentication failed for fd=" + to_string(ci.sockfd)) << endl;
-                    close(ci.sockfd);
-                    clients.erase(clients.begin()+ci_idx);
-                    ci_idx--;
-                    idx--;
-                    continue;
-                }
-            }
-            // MSG handling: MSG|TargetCampus|TargetDept|DeptForFrom|Body
-            else if (toks[0]=="MSG" && toks.size()>=4) {
-                string targetRaw = toks[1];
-                string targetDeptRaw = toks[2];
-                string body = toks[3];
-
-                string targetLower = to_lower(targetRaw);
-                string targetDeptLower = to_lower(targetDeptRaw);
-
-                string fromDisplay = "(Unknown)";
-                string fromDeptDisplay = "";
-                if (!ci.campusLower.empty()) {
-                    fromDisplay = ci.campusDisplay;
-                    fromDeptDisplay = ci.deptDisplay;
-                }
+        for (size_t idx = 4; idx < pfds.size(); ++idx) {
+            if (!(pfds[idx].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            char buf[BUFFER_SIZE];
+            ssize_t r = recv(pfds[idx].fd, buf, sizeof(buf), 0);
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+            on_client_data(pfds[idx].fd, buf, r);
+        }
 
-                string forward = "FROM|" + fromDisplay + "|" + fromDeptDisplay + "|" + body;
-
-                string key = targetLower + "|" + targetDeptLower;
-                if (routing_map.count(key)) {
-                    int tidx = routing_map[key];
-                    int sock_target = clients[tidx].sockfd;
-                    if (send(sock_target, forward.c_str(), forward.size(),0)<0) perror("send");
-                    string routedMsg = "Routed " + fromDisplay + "-" + fromDeptDisplay + " -> " +
-                                        (campus_display_name.count(targetLower)?campus_display_name[targetLower]:targetRaw) +
-                                        "-" + targetDeptRaw + " : " + body;
-                    routing_log.push_back(make_log(routedMsg));
-                    cout << make_log(routedMsg) << endl;
-                } else {
-                    string err = "ERR|Target offline or unknown: " + targetRaw + "-" + targetDeptRaw;
-                    if (send(ci.sockfd, err.c_str(), err.size(),0)<0) perror("send");
-                }
-            }
-            // FILE handling: FILE|TargetCampus|TargetDept|Filename|Base64Content
-            else if (toks[0]=="FILE" && toks.size()>=5) {
-                string targetRaw = toks[1];
-                string targetDeptRaw = toks[2];
-                string filename = toks[3];
-                // remaining tokens after 4th are part of base64 content (in case '|' inside)
-                string b64;
-                // re-join all remaining tokens into b64
-                size_t pos = msg.find("|", 0);
-                // We need to find the position of 4th '|' to extract exact b64 substring easily
-                int seen = 0;
-                size_t i;
-                for (i = 0; i < msg.size(); ++i) {
-                    if (msg[i] == '|') {
-                        seen++;
-                        if (seen == 4) { ++i; break; }
-                    }
-                }
-                if (i < msg.size()) b64 = msg.substr(i);
-                else if (toks.size()>=5) b64 = toks[4];
-
-                string targetLower = to_lower(targetRaw);
-                string targetDeptLower = to_lower(targetDeptRaw);
-                string fromDisplay = ci.campusDisplay;
-                string fromDeptDisplay = ci.deptDisplay;
-
-                string forward = "FILEFROM|" + fromDisplay + "|" + fromDeptDisplay + "|" + filename + "|" + b64;
-
-                string key = targetLower + "|" + targetDeptLower;
-                if (routing_map.count(key)) {
-                    int tidx = routing_map[key];
-                    int sock_target = clients[tidx].sockfd;
-                    if (send(sock_target, forward.c_str(), forward.size(),0)<0) perror("send");
-                    string routedMsg = "File routed " + fromDisplay + "-" + fromDeptDisplay + " -> " +
-                                        (campus_display_name.count(targetLower)?campus_display_name[targetLower]:targetRaw) +
-                                        "-" + targetDeptRaw + " : " + filename;
-                    routing_log.push_back(make_log(routedMsg));
-                    cout << make_log(routedMsg) << endl;
-                } else {
-                    string err = "ERR|Target offline or unknown: " + targetRaw + "-" + targetDeptRaw;
-                    if (send(ci.sockfd, err.c_str(), err.size(),0)<0) perror("send");
-                }
-            }
-            else {
-                cout << make_log("Unknown TCP payload from fd="+to_string(ci.sockfd)+" -> "+msg) << endl;
+        end_of_turn();
+    }
+}
+
+#ifdef USE_IO_URING
+// Completion loop: accepts, client data and sends finish inside the kernel and
+// come back as events; everything queued is submitted with the next wait
+void uring_loop(int listen_fd, int udp_fd) {
+    uring_watch_listener(uring, listen_fd);
+    uring_watch_readable(uring, udp_fd);
+    if (repl.listen_fd >= 0) uring_watch_readable(uring, repl.listen_fd);
+    if (standby.fd >= 0) uring_watch_readable(uring, standby.fd);
+
+    vector<UringEvent> events;
+    while (true) {
+        uring_wait(uring, events, 1000);
+
+        lock_guard<mutex> lock(global_mutex);
+        for (auto &e : events) {
+            switch (e.kind) {
+            case UringEvent::ACCEPTED: on_client_accepted(e.fd); break;
+            case UringEvent::DATA:     on_client_data(e.fd, e.data, e.len); break;
+            case UringEvent::CLOSED:   on_client_data(e.fd, nullptr, 0); break;
+            case UringEvent::READABLE:
+                if (e.fd == udp_fd) on_udp_readable(udp_fd);
+                else if (e.fd == repl.listen_fd) on_repl_listen_readable();
+                else on_repl_peer_readable();
+                break;
+            case UringEvent::SENT: break; // the next outbox for that client goes out in end_of_turn()
             }
         }
+        end_of_turn();
+    }
+}
+#endif
 
-        // --- Heartbeat monitoring (mark offline if missed MAX_MISSED_HEARTBEATS) ---
-        time_t now = time(nullptr);
-        for (auto &kv : campusStatus) {
-            auto &key = kv.first;
-            auto &cs = kv.second;
-            if (cs.online) {
-                double diff = difftime(now, cs.lastHeartbeat);
-                if (diff > HEARTBEAT_INTERVAL) {
-                    cs.missedCount++;
-                    if (cs.missedCount >= MAX_MISSED_HEARTBEATS) {
-                        cs.online = false;
-                        string disp = key;
-                        if (campus_display_name.count(key)) disp = campus_display_name[key];
-                        cout << make_log(disp + " marked OFFLINE due to missed heartbeats") << endl;
-                    }
-                }
-            }
+// Intern the campuses (ids index campus_password and campusStatus)
+void intern_campuses() {
+    for (auto &p : credentials) {
+        campuses.intern(p.first);
+        campus_password.push_back(p.second);
+        campusStatus.push_back(CampusStatus());
+    }
+}
+
+void usage() {
+    cerr << "Usage: ./server [--port TCP_PORT] [--repl-port PORT] [--standby PRIMARY_HOST:REPL_PORT] [--io-uring]\n"
+         << "                [--capture TRACE_FILE]\n"
+         << "  primary (default): clients on TCP 9090 / UDP 9091, standby link on 9092\n"
+         << "  standby example:   ./server --port 9190 --standby 127.0.0.1:9092\n"
+         << "  --io-uring:        use the io_uring backend if the kernel supports it (falls back to poll)\n"
+         << "  --capture:         record inbound TCP frames and UDP datagrams for ./replay\n";
+}
+
+int main(int argc, char *argv[]) {
+    int udp_port = UDP_PORT, repl_port = REPL_PORT;
+    bool want_uring = false;
+    string capture_path;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        if (a == "--port" && i + 1 < argc) {
+            tcp_port = atoi(argv[++i]);
+            udp_port = tcp_port + 1;
+        } else if (a == "--repl-port" && i + 1 < argc) {
+            repl_port = atoi(argv[++i]);
+        } else if (a == "--standby" && i + 1 < argc) {
+            string hp = argv[++i];
+            size_t c = hp.rfind(':');
+            primary_host = hp.substr(0, c);
+            if (c != string::npos) primary_repl_port = atoi(hp.c_str() + c + 1);
+            standby_mode = true;
+        } else if (a == "--io-uring") {
+            want_uring = true;
+        } else if (a == "--capture" && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else {
+            usage();
+            return 1;
         }
+    }
 
-    } // main loop
+    cout << make_log(string("Starting Central Server (") + (standby_mode ? "standby" : "primary") + ")") << endl;
+    intern_campuses();
+
+    // TCP socket
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) { perror("socket"); return 1; }
+
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in srvAddr{};
+    srvAddr.sin_family = AF_INET;
+    srvAddr.sin_port = htons(tcp_port);
+    srvAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(listen_fd, (sockaddr*)&srvAddr, sizeof(srvAddr)) < 0) { perror("bind"); return 1; }
+    if (listen(listen_fd, 50) < 0) { perror("listen"); return 1; }
+
+    set_nonblocking(listen_fd);
+
+    // UDP socket
+    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_fd < 0) { perror("udp socket"); return 1; }
+
+    sockaddr_in udpAddr{};
+    udpAddr.sin_family = AF_INET;
+    udpAddr.sin_port = htons(udp_port);
+    udpAddr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(udp_fd, (sockaddr*)&udpAddr, sizeof(udpAddr)) < 0) { perror("udp bind"); return 1; }
+    set_nonblocking(udp_fd);
+
+    cout << make_log("TCP port: " + to_string(tcp_port) + ", UDP port: " + to_string(udp_port)) << endl;
+
+    if (!capture_path.empty()) {
+        if (!capture_open(capture, capture_path)) { perror("capture file"); return 1; }
+        cout << make_log("Capturing traffic to " + capture_path) << endl;
+    }
+
+    // Replication: a primary listens for a standby, a standby follows its primary
+    if (standby_mode) {
+        standby.fd = repl_connect(primary_host, primary_repl_port);
+        if (standby.fd < 0) { perror("connect to primary"); return 1; }
+        standby.link_up = true;
+        cout << make_log("Following primary at " + primary_host + ":" + to_string(primary_repl_port)) << endl;
+    } else {
+        repl.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (repl.listen_fd < 0) { perror("repl socket"); return 1; }
+        setsockopt(repl.listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in replAddr{};
+        replAddr.sin_family = AF_INET;
+        replAddr.sin_port = htons(repl_port);
+        replAddr.sin_addr.s_addr = INADDR_ANY;
+        if (bind(repl.listen_fd, (sockaddr*)&replAddr, sizeof(replAddr)) < 0) { perror("repl bind"); return 1; }
+        if (listen(repl.listen_fd, 1) < 0) { perror("repl listen"); return 1; }
+        set_nonblocking(repl.listen_fd);
+        cout << make_log("Replication port: " + to_string(repl_port)) << endl;
+    }
+
+    // Start admin thread
+    thread(admin_menu, udp_fd).detach();
+
+    // Pick the I/O backend
+    if (want_uring) {
+#ifdef USE_IO_URING
+        string why;
+        use_uring = uring_init(uring, why);
+        if (!use_uring) cout << make_log("io_uring unavailable (" + why + "), falling back to poll()") << endl;
+#else
+        cout << make_log("Built without io_uring (make IO_URING=1), using poll()") << endl;
+#endif
+    }
+    cout << make_log(string("I/O backend: ") + (use_uring ? "io_uring" : "poll")) << endl;
+#ifdef COUNT_ALLOCS
+    count_allocs = true;
+#endif
+
+#ifdef USE_IO_URING
+    if (use_uring) uring_loop(listen_fd, udp_fd);
+#endif
+    poll_loop(listen_fd, udp_fd);
 
     close(listen_fd);
     close(udp_fd);
     return 0;
 }
-
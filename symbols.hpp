@@ -0,0 +1,88 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+// Interned names (campuses, departments).
+//
+// Each distinct name gets a small integer id the first time it is seen; names
+// compare case-insensitively and the first spelling is kept for display. The
+// hash is taken over the case-folded bytes, so looking up a name straight out
+// of a received frame needs neither to_lower() nor a temporary string.
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static const uint32_t NO_SYMBOL = 0xFFFFFFFF;
+
+// FNV-1a over the lowercased bytes
+inline uint64_t fold_hash(const char *p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)std::tolower((unsigned char)p[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline bool fold_equal(const char *p, size_t n, const std::string &s) {
+    if (n != s.size()) return false;
+    for (size_t i = 0; i < n; ++i)
+        if (std::tolower((unsigned char)p[i]) != std::tolower((unsigned char)s[i])) return false;
+    return true;
+}
+
+struct SymbolTable {
+    std::vector<std::string> names;  // id -> display spelling
+    std::vector<uint64_t> hashes;    // id -> fold_hash of the name
+    std::vector<uint32_t> slots;     // open addressing (linear probing), NO_SYMBOL = empty
+
+    uint32_t find(const char *p, size_t n) const {
+        if (slots.empty()) return NO_SYMBOL;
+        uint64_t h = fold_hash(p, n);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask; slots[i] != NO_SYMBOL; i = (i + 1) & mask) {
+            uint32_t id = slots[i];
+            if (hashes[id] == h && fold_equal(p, n, names[id])) return id;
+        }
+        return NO_SYMBOL;
+    }
+    uint32_t find(std::string_view s) const { return find(s.data(), s.size()); }
+
+    // Id for name, adding it if it is new
+    uint32_t intern(std::string_view name) {
+        uint32_t id = find(name);
+        if (id != NO_SYMBOL) return id;
+        if ((names.size() + 1) * 2 > slots.size()) grow();
+        id = (uint32_t)names.size();
+        names.emplace_back(name);
+        hashes.push_back(fold_hash(name.data(), name.size()));
+        place(id);
+        return id;
+    }
+
+    const std::string &name(uint32_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+private:
+    void place(uint32_t id) {
+        size_t mask = slots.size() - 1;
+        size_t i = hashes[id] & mask;
+        while (slots[i] != NO_SYMBOL) i = (i + 1) & mask;
+        slots[i] = id;
+    }
+
+    // keep the load factor at or below 1/2
+    void grow() {
+        slots.assign(slots.empty() ? 16 : slots.size() * 2, NO_SYMBOL);
+        for (uint32_t id = 0; id < names.size(); ++id) place(id);
+    }
+};
+
+// One department at one campus, packed for integer-keyed hash tables
+inline uint64_t route_key(uint32_t campus, uint32_t dept) {
+    return ((uint64_t)campus << 32) | dept;
+}
+
+#endif // SYMBOLS_HPP
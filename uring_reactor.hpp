@@ -0,0 +1,390 @@
+#ifndef URING_REACTOR_HPP
+#define URING_REACTOR_HPP
+
+// Optional io_uring backend for the server loop (built with USE_IO_URING,
+// enabled with ./server --io-uring). Talks to the kernel directly, no liburing.
+//
+// - multishot accept on the listening socket
+// - multishot recv on every client socket, landing in a provided buffer ring
+// - multishot poll for the UDP and replication sockets (read with normal syscalls)
+// - one send per client per turn (the outbox is already coalesced); a send of
+//   URING_ZC_THRESHOLD bytes or more uses SEND_ZC, whatever frames it holds
+//   (in practice a FILE relay or a turn's worth of backlog)
+// Everything queued during a loop turn is submitted by the same io_uring_enter()
+// that waits for the next completions.
+//
+// uring_init() fails on kernels without provided buffer rings / EXT_ARG (< 5.19)
+// and the server falls back to poll(). Multishot recv (6.0) and SEND_ZC are
+// optional: they degrade to single-shot recv and plain send.
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+
+static const unsigned URING_ENTRIES = 1024;
+static const unsigned URING_BUF_COUNT = 256;         // provided receive buffers (power of two)
+static const unsigned URING_BUF_SIZE = BUFFER_SIZE;
+static const unsigned URING_BUF_GROUP = 1;
+static const size_t URING_ZC_THRESHOLD = 16 * 1024;  // send-zerocopy from this size up
+
+// user_data layout: op (8 bits) | generation (24 bits) | fd (32 bits); sends carry a slot instead
+enum : uint64_t { URING_ACCEPT = 1, URING_RECV, URING_POLL, URING_SEND, URING_CANCEL };
+
+// What the server loop gets back from one turn
+struct UringEvent {
+    enum Kind { ACCEPTED, DATA, CLOSED, READABLE, SENT } kind;
+    int fd;
+    const char *data = nullptr; // DATA: valid until the next uring_wait()
+    size_t len = 0;
+};
+
+struct UringSend {
+    int fd;
+    std::string buf;
+    size_t off = 0;
+    bool sending = true; // false once all bytes are out (or the send failed)
+    int notifs = 0;      // SEND_ZC notifications still owed by the kernel
+};
+
+struct UringReactor {
+    int ring_fd = -1;
+    void *sq_ptr = nullptr, *cq_ptr = nullptr;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    unsigned sq_entries = 0;
+    unsigned to_submit = 0;
+
+    io_uring_buf_ring *br = nullptr;   // provided buffer ring
+    size_t br_size = 0;
+    std::vector<char> bufs;
+    uint16_t br_tail = 0;
+    std::vector<uint16_t> recycle;     // buffers handed out last turn
+
+    bool multishot_recv = true;
+    bool zc_ok = false;
+    std::unordered_map<int, uint32_t> gen;       // fd -> generation of its registration
+    std::deque<UringSend> sends;                 // slots (stable addresses: the kernel reads buf)
+    std::vector<uint32_t> free_sends;            // finished slots, reused with their buffers
+    std::vector<int64_t> sending;                // fd -> slot of the send in progress, -1 if none
+
+    // stats (read by the admin thread)
+    std::atomic<uint64_t> enters{0}, completions{0}, zc_sends{0};
+};
+
+inline int uring_setup(unsigned entries, io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+inline int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, argsz);
+}
+inline int uring_register(int fd, unsigned op, void *arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+inline uint64_t uring_fd_data(uint64_t op, uint32_t g, int fd) {
+    return (op << 56) | ((uint64_t)(g & 0xFFFFFF) << 32) | (uint32_t)fd;
+}
+
+// Next free SQE (submits early if the ring is full)
+inline io_uring_sqe *uring_sqe(UringReactor &u) {
+    unsigned tail = *u.sq_tail;
+    if (tail - __atomic_load_n(u.sq_head, __ATOMIC_ACQUIRE) >= u.sq_entries) {
+        uring_enter(u.ring_fd, u.to_submit, 0, 0, nullptr, 0);
+        u.enters++;
+        u.to_submit = 0;
+    }
+    unsigned idx = tail & *u.sq_mask;
+    io_uring_sqe *sqe = &u.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u.sq_array[idx] = idx;
+    __atomic_store_n(u.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u.to_submit++;
+    return sqe;
+}
+
+inline void uring_provide(UringReactor &u, uint16_t bid) {
+    // index by hand: in C++ the header's flex-array member is not at offset 0
+    io_uring_buf *b = (io_uring_buf*)u.br + (u.br_tail & (URING_BUF_COUNT - 1));
+    b->addr = (uint64_t)(uintptr_t)(u.bufs.data() + (size_t)bid * URING_BUF_SIZE);
+    b->len = URING_BUF_SIZE;
+    b->bid = bid;
+    u.br_tail++;
+    __atomic_store_n(&u.br->tail, u.br_tail, __ATOMIC_RELEASE);
+}
+
+inline bool uring_op_supported(io_uring_probe *p, unsigned op) {
+    return op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+// Unmap the rings and close the ring fd (failed uring_init: the server falls back to poll)
+inline void uring_close(UringReactor &u) {
+    if (u.br) munmap(u.br, u.br_size);
+    if (u.sqes) munmap(u.sqes, u.sqes_size);
+    if (u.sq_ptr) munmap(u.sq_ptr, u.sq_size);
+    if (u.ring_fd >= 0) close(u.ring_fd);
+    u.br = nullptr;
+    u.sqes = nullptr;
+    u.cqes = nullptr;
+    u.sq_ptr = u.cq_ptr = nullptr;
+    u.ring_fd = -1;
+}
+
+// Set up the ring and the receive buffers; why explains a failure
+inline bool uring_init(UringReactor &u, std::string &why) {
+    io_uring_params p{};
+    u.ring_fd = uring_setup(URING_ENTRIES, &p);
+    if (u.ring_fd < 0) { why = std::string("io_uring_setup: ") + strerror(errno); return false; }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        why = "kernel lacks SINGLE_MMAP/EXT_ARG/NODROP";
+        uring_close(u);
+        return false;
+    }
+
+    u.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (u.cq_size > u.sq_size) u.sq_size = u.cq_size;
+    void *sq_ptr = mmap(nullptr, u.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u.ring_fd, IORING_OFF_SQ_RING);
+    u.sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, u.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u.ring_fd, IORING_OFF_SQES);
+    if (sq_ptr != MAP_FAILED) u.sq_ptr = sq_ptr;
+    if (sqes != MAP_FAILED) u.sqes = (io_uring_sqe*)sqes;
+    if (!u.sq_ptr || !u.sqes) { why = "mmap of ring failed"; uring_close(u); return false; }
+    u.cq_ptr = u.sq_ptr;
+    char *sq = (char*)u.sq_ptr;
+    u.sq_head = (unsigned*)(sq + p.sq_off.head);
+    u.sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u.sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u.sq_array = (unsigned*)(sq + p.sq_off.array);
+    u.sq_entries = p.sq_entries;
+    u.cq_head = (unsigned*)(sq + p.cq_off.head);
+    u.cq_tail = (unsigned*)(sq + p.cq_off.tail);
+    u.cq_mask = (unsigned*)(sq + p.cq_off.ring_mask);
+    u.cqes = (io_uring_cqe*)(sq + p.cq_off.cqes);
+
+    // which opcodes does this kernel know?
+    size_t probe_len = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::vector<char> probe_mem(probe_len, 0);
+    io_uring_probe *probe = (io_uring_probe*)probe_mem.data();
+    if (uring_register(u.ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        !uring_op_supported(probe, IORING_OP_ACCEPT) || !uring_op_supported(probe, IORING_OP_RECV) ||
+        !uring_op_supported(probe, IORING_OP_SEND) || !uring_op_supported(probe, IORING_OP_POLL_ADD) ||
+        !uring_op_supported(probe, IORING_OP_ASYNC_CANCEL)) {
+        why = "kernel lacks accept/recv/send/poll opcodes";
+        uring_close(u);
+        return false;
+    }
+    u.zc_ok = uring_op_supported(probe, IORING_OP_SEND_ZC);
+
+    // provided buffer ring for receives
+    u.br_size = URING_BUF_COUNT * sizeof(io_uring_buf);
+    void *br = mmap(nullptr, u.br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br == MAP_FAILED) { why = "mmap of buffer ring failed"; uring_close(u); return false; }
+    u.br = (io_uring_buf_ring*)br;
+    io_uring_buf_reg reg{};
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (uring_register(u.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        why = std::string("provided buffer ring: ") + strerror(errno);
+        uring_close(u);
+        return false;
+    }
+    u.bufs.resize((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    for (unsigned i = 0; i < URING_BUF_COUNT; ++i) uring_provide(u, (uint16_t)i);
+    return true;
+}
+
+// Multishot accept on a listening socket
+inline void uring_watch_listener(UringReactor &u, int fd) {
+    io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_fd_data(URING_ACCEPT, 0, fd);
+}
+
+// Multishot readiness for sockets the server reads itself (UDP, replication)
+inline void uring_watch_readable(UringReactor &u, int fd) {
+    io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = uring_fd_data(URING_POLL, u.gen[fd], fd);
+}
+
+inline void uring_arm_recv(UringReactor &u, int fd) {
+    io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    if (u.multishot_recv) sqe->ioprio = IORING_RECV_MULTISHOT;
+    else sqe->len = URING_BUF_SIZE;
+    sqe->user_data = uring_fd_data(URING_RECV, u.gen[fd], fd);
+}
+
+// Start receiving on a new client socket
+inline void uring_add_client(UringReactor &u, int fd) {
+    u.gen[fd]++;
+    uring_arm_recv(u, fd);
+}
+
+// Stop watching fd before the caller closes it: cancel by exact user_data so a
+// reused fd number is never hit, and shut the socket down so multishot requests end
+inline void uring_forget(UringReactor &u, int fd, bool client) {
+    uint64_t target = uring_fd_data(client ? URING_RECV : URING_POLL, u.gen[fd], fd);
+    io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = target;
+    sqe->user_data = uring_fd_data(URING_CANCEL, 0, fd);
+    shutdown(fd, SHUT_RDWR);
+    u.gen[fd]++;
+    if ((size_t)fd < u.sending.size()) u.sending[fd] = -1;
+}
+
+inline void uring_submit_send(UringReactor &u, uint64_t id) {
+    UringSend &s = u.sends[id];
+    size_t left = s.buf.size() - s.off;
+    io_uring_sqe *sqe = uring_sqe(u);
+    if (u.zc_ok && left >= URING_ZC_THRESHOLD) {
+        sqe->opcode = IORING_OP_SEND_ZC;
+        u.zc_sends++;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+    }
+    sqe->fd = s.fd;
+    sqe->addr = (uint64_t)(uintptr_t)(s.buf.data() + s.off);
+    sqe->len = (unsigned)left;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (URING_SEND << 56) | id;
+}
+
+// Hand a buffer to the kernel; one send per fd is in flight at a time
+inline bool uring_send_busy(const UringReactor &u, int fd) {
+    return (size_t)fd < u.sending.size() && u.sending[fd] >= 0;
+}
+
+// buf is swapped with the (emptied) buffer of a finished send, so outboxes
+// keep reusing grown allocations instead of getting a new one per send
+inline void uring_send(UringReactor &u, int fd, std::string &buf) {
+    uint32_t id;
+    if (!u.free_sends.empty()) {
+        id = u.free_sends.back();
+        u.free_sends.pop_back();
+    } else {
+        id = (uint32_t)u.sends.size();
+        u.sends.emplace_back();
+    }
+    UringSend &s = u.sends[id];
+    s.fd = fd;
+    s.off = 0;
+    s.sending = true;
+    s.notifs = 0;
+    s.buf.swap(buf);
+    buf.clear();
+    if ((size_t)fd >= u.sending.size()) u.sending.resize(fd + 1, -1);
+    u.sending[fd] = id;
+    uring_submit_send(u, id);
+}
+
+inline void uring_on_send_cqe(UringReactor &u, const io_uring_cqe &c, std::vector<UringEvent> &ev) {
+    uint64_t id = c.user_data & ((1ULL << 56) - 1);
+    if (id >= u.sends.size()) return;
+    UringSend &s = u.sends[id];
+    if (c.flags & IORING_CQE_F_NOTIF) {
+        s.notifs--;
+    } else {
+        if (c.flags & IORING_CQE_F_MORE) s.notifs++; // SEND_ZC: buffer pinned until the notification
+        bool current = uring_send_busy(u, s.fd) && u.sending[s.fd] == (int64_t)id;
+        if (c.res > 0) s.off += c.res;
+        if (current && c.res > 0 && s.off < s.buf.size()) {
+            uring_submit_send(u, id);
+        } else {
+            s.sending = false;
+            if (current) {
+                u.sending[s.fd] = -1;
+                ev.push_back({UringEvent::SENT, s.fd});
+            }
+        }
+    }
+    if (!s.sending && s.notifs == 0) u.free_sends.push_back((uint32_t)id);
+}
+
+// Submit everything queued, wait up to timeout_ms for completions and translate them
+inline void uring_wait(UringReactor &u, std::vector<UringEvent> &ev, int timeout_ms) {
+    ev.clear();
+    for (uint16_t bid : u.recycle) uring_provide(u, bid);
+    u.recycle.clear();
+
+    __kernel_timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int r = uring_enter(u.ring_fd, u.to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    u.enters++;
+    if (r >= 0) u.to_submit -= (unsigned)r;
+    else if (errno != ETIME && errno != EINTR && errno != EBUSY) perror("io_uring_enter");
+
+    unsigned head = *u.cq_head;
+    unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        io_uring_cqe c = u.cqes[head & *u.cq_mask];
+        u.completions++;
+        uint64_t op = c.user_data >> 56;
+        int fd = (int)(uint32_t)c.user_data;
+        uint32_t g = (uint32_t)(c.user_data >> 32) & 0xFFFFFF;
+
+        if (op == URING_ACCEPT) {
+            if (c.res >= 0) ev.push_back({UringEvent::ACCEPTED, c.res});
+            if (!(c.flags & IORING_CQE_F_MORE)) uring_watch_listener(u, fd);
+        } else if (op == URING_RECV) {
+            bool has_buf = c.flags & IORING_CQE_F_BUFFER;
+            uint16_t bid = (uint16_t)(c.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (has_buf) u.recycle.push_back(bid);
+            if (g != (u.gen[fd] & 0xFFFFFF)) continue; // connection already dropped
+            if (c.res > 0) {
+                ev.push_back({UringEvent::DATA, fd, u.bufs.data() + (size_t)bid * URING_BUF_SIZE, (size_t)c.res});
+                if (!(c.flags & IORING_CQE_F_MORE)) uring_arm_recv(u, fd);
+            } else if (c.res == -ENOBUFS) {
+                uring_arm_recv(u, fd); // buffers come back next turn
+            } else if (c.res == -EINVAL && u.multishot_recv) {
+                u.multishot_recv = false; // pre-6.0 kernel: single-shot recv from now on
+                uring_arm_recv(u, fd);
+            } else if (c.res != -ECANCELED) {
+                ev.push_back({UringEvent::CLOSED, fd});
+            }
+        } else if (op == URING_POLL) {
+            if (g != (u.gen[fd] & 0xFFFFFF) || c.res < 0) continue;
+            ev.push_back({UringEvent::READABLE, fd});
+            if (!(c.flags & IORING_CQE_F_MORE)) uring_watch_readable(u, fd);
+        } else if (op == URING_SEND) {
+            uring_on_send_cqe(u, c, ev);
+        }
+    }
+    __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif // URING_REACTOR_HPP